@@ -1,160 +1,646 @@
+#if HALF_FIT_PER_CPU
+#define _GNU_SOURCE //sched_getcpu
+#endif
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <limits.h>
-#include <math.h>
+#if HALF_FIT_STATS
+#include <stdarg.h>
+#endif
+#if HALF_FIT_TRACE
+#include <time.h>
+#endif
+#if HALF_FIT_PROFILE
+#include <execinfo.h>
+#endif
 #include "half_fit.h"
 #include "type.h"
+#if HALF_FIT_THREAD_SAFE
+#include <pthread.h>
+#endif
+#if HALF_FIT_PER_CPU
+#include <sched.h>
+#include <unistd.h>
+#endif
+#if HALF_FIT_GROW
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if HALF_FIT_MAPPED || HALF_FIT_SHARED
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if HALF_FIT_SHARED && !HALF_FIT_THREAD_SAFE
+#include <pthread.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//count leading/trailing zeros of a non-zero 32-bit word in a single instruction where the target has one
+//(CLZ on Cortex-M3, BSR/LZCNT and BSF/TZCNT on x86)
+#if defined(__GNUC__)
+#define HF_CLZ(x) ((U32)__builtin_clz(x))
+#define HF_CTZ(x) ((U32)__builtin_ctz(x))
+#elif defined(__CC_ARM)
+#define HF_CLZ(x) ((U32)__clz(x))
+#define HF_CTZ(x) (31 - (U32)__clz((x) & (0u - (x))))
+#else
+static U32 hf_clz(U32 x)
+{
+    U32 n = 0;
+
+    if (!(x & 0xFFFF0000)) { n += 16; x <<= 16; }
+    if (!(x & 0xFF000000)) { n += 8;  x <<= 8;  }
+    if (!(x & 0xF0000000)) { n += 4;  x <<= 4;  }
+    if (!(x & 0xC0000000)) { n += 2;  x <<= 2;  }
+    if (!(x & 0x80000000)) { n += 1; }
+    return n;
+}
+#define HF_CLZ(x) hf_clz(x)
+#define HF_CTZ(x) (31 - hf_clz((x) & (0u - (x))))
+#endif
+
+//in thread safe builds the header word of an allocated block can be read by its owner while a neighbour rewrites
+//its prev field under the lock; those two accesses are made atomic (relaxed, which is a plain load/store on every
+//target we run on) so that the race is a defined one
+#if HALF_FIT_THREAD_SAFE
+#define HF_LOAD_RELAXED(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define HF_STORE_RELAXED(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#else
+#define HF_LOAD_RELAXED(p)      (*(p))
+#define HF_STORE_RELAXED(p, v)  (*(p) = (v))
+#endif
+
+//a mapped or shared heap left by a process that died is rebuilt by walking the block sizes, so a header that
+//shrinks must not reach memory before the header of the block it gives way to. The stores are ordered for the
+//compiler only: a process that dies still leaves every store it made in the mapping
+#if HALF_FIT_MAPPED || HALF_FIT_SHARED
+#define HF_SIZE_FENCE()         __atomic_signal_fence(__ATOMIC_RELEASE)
+#else
+#define HF_SIZE_FENCE()         ((void)0)
+#endif
+
+#define NO_BLOCK        0xFFFFFFFFu     //an offset that never names a block, ends lists that cannot point at themselves
 
 //global variable declaration
-half_fit_t half_fit;
-char *base_address;
+half_fit_t half_fit; //the default heap behind half_init/half_alloc/half_free
 U32 init_size = 32768;
-char *bin_ptrs[11]; //initialize an array of char pointers to point to the first block in each bin (initially NULL)
+static char *default_heap; //memory of the default heap, reused by every half_init
+
+#if HALF_FIT_STATS
+#define HF_STAT(statement)  statement
+#else
+#define HF_STAT(statement)  ((void)0)
+#endif
+
+#if HALF_FIT_WIDE_HEADER
+/*
+    Wide block header layout: two aligned 32 bit words at the start of every block
+        word 0          offset of the previous block in memory
+        word 1 bits 31-2  size of the block (1 to 2^30 - 1)
+               bit     1  1 if the block is allocated
+               bit     0  0 in an allocated block, see PAD_FLAG; in a free block 1 if it is known to be zero
+    The next block in memory is always offset + size, so it is not stored; the block whose end is the end of the
+    arena has no next block. Free blocks also keep their bin links in the two words after the header:
+        word 2          offset of the previous block in the same bin
+        word 3          offset of the next block in the same bin
+*/
+typedef struct half_header {
+    U32 prev_in_mem;
+    U32 size;
+} half_header_t;
+
+typedef struct half_links {
+    U32 prev_in_bin;
+    U32 next_in_bin;
+} half_links_t;
+
+#define HDR_SIZE        2
+#define HDR_ALLOCATED   0x2u
+#define HDR_ZERO        0x1u
+#else
+/*
+    Block header layout: one aligned 32 bit word at the start of every block
+        bits 31-22  offset of the previous block in memory
+        bits 21-12  offset of the next block in memory
+        bits 11- 2  size of the block (1 to 1024, 1024 is stored as 0000000000)
+        bit      1  1 if the block is allocated
+        bit      0  0 in an allocated block, see PAD_FLAG; in a free block 1 if it is known to be zero
+    Free blocks also keep their bin links in the word after the header:
+        bits 31-22  offset of the previous block in the same bin
+        bits 21-12  offset of the next block in the same bin
+*/
+typedef U32 half_header_t;
+typedef U32 half_links_t;
+
+#define HDR_PREV        22
+#define HDR_NEXT        12
+#define HDR_SIZE        2
+#define HDR_ALLOCATED   0x2u
+#define HDR_ZERO        0x1u
+#define BIN_PREV        22
+#define BIN_NEXT        12
+#define FIELD_MASK      0x3FFu
+#endif
+/*
+    Every offset and size is counted in 32 byte units from the arena's base_address. A link that points back at
+    the block itself means there is no such neighbour. Blocks start on 32 byte boundaries of a word aligned base,
+    so the header and the links are always aligned and each is read or written as a whole; fields are then one
+    shift and one mask away. The header ends where the block's memory starts (in 16 byte alignment mode the bytes
+    in front of it are unused), so the word right before the memory of a block is always a header word.
+    A free block known to be zero has every byte after its bin links zero: it was carved from memory that came
+    zeroed (from the OS, or from calloc) and has not been handed out since. Headers and links written into it when
+    it is split land before the memory of the pieces, which inherit the mark; a block that was handed out loses it
+    for good, and so does any block it is merged with when it comes back.
+*/
+#define HEADER(block_addr)  (*(half_header_t *)((block_addr) + HALF_FIT_HEADER_SIZE - sizeof(half_header_t)))
+#define LINKS(block_addr)   (*(half_links_t *)((block_addr) + HALF_FIT_HEADER_SIZE))
 
-//this helper fcn initializes the bits that represent addresses of the next and prev blocks in a bucket to 0
-//this ONLY works for the initial block of 32768 bytes
-void half_init_unallocated_block (char *address)
+#if HALF_FIT_WIDE_HEADER
+static __inline half_header_t half_make_header(U32 prev_in_mem, U32 next_in_mem, U32 size, BOOL allocated)
 {
-    *(address + 4) = *(address + 4) >> 8; // initialize the previous bucket ptr to 0s
-    *(address + 5) = *(address + 5) >> 8; // initialize the next bucket ptr to 0s
-    *(address + 6) = *(address + 6) >> 4; // complete the initialization
+    half_header_t header;
 
+    (void)next_in_mem; //implied by the size
+    header.prev_in_mem = prev_in_mem;
+    header.size = (size << HDR_SIZE) | (allocated ? HDR_ALLOCATED : 0);
+    return header;
 }
 
-void  half_init( void )
+static __inline U32 half_prev_of(half_header_t header)
 {
-    U32 i;
-    base_address = (char *) malloc(init_size);
-    printf("Base Address: %d %x\n", base_address, base_address);
-
-    //initializing header (first 4 bytes)
-    // both previous and next ptrs in the header are pointing to 0000000000 (pointing to itself)
-    *base_address = *base_address >> 8; //set the first 8 bits to 0
-    *(base_address + 1) = *(base_address + 1) >> 8;//the next 8 bits to 0
-    *(base_address + 2) = *(base_address + 2) >> 8;// this completes the declaration of previous and next to itself
-    //size of 1024 will be represented as 0000000000 because size can be between 1 and 1024 but 1024 requires 11 bits to represent; since block size is minimum 1, we can use 0000000000 to represent it
-    *(base_address + 3) = *(base_address + 3) >> 8; //6 bits for size, 1 bit for unallocated, 1 bit don't care
-    printf("Base Address: %d %x  %d\n", base_address, base_address, &base_address);
-
-    //initializing elements of bin_ptrs array to NULL
-    for(i = 0; i < 11; ++i)
-    {
-        bin_ptrs[i] = NULL;
-        printf("Bin Ptrs %p", bin_ptrs[i]);
+    return header.prev_in_mem;
+}
+
+static __inline U32 half_next_of(half_fit_t *hf, half_header_t header, U32 offset)
+{
+    U32 next_in_mem = offset + (header.size >> HDR_SIZE);
+
+    return (next_in_mem == hf->size) ? offset : next_in_mem;
+}
+
+static __inline U32 half_size_of(half_header_t header)
+{
+    return header.size >> HDR_SIZE;
+}
+
+static __inline BOOL half_is_allocated(half_header_t header)
+{
+    return (header.size & HDR_ALLOCATED) != 0;
+}
+
+static __inline BOOL half_is_zero(half_header_t header)
+{
+    return (header.size & (HDR_ALLOCATED | HDR_ZERO)) == HDR_ZERO;
+}
+
+static __inline void half_mark_zero(char *block_addr)
+{
+    HEADER(block_addr).size |= HDR_ZERO;
+}
+
+static __inline void half_set_prev(char *block_addr, U32 prev_in_mem)
+{
+    HEADER(block_addr).prev_in_mem = prev_in_mem;
+}
+
+//size of an allocated block, read by its owner without holding any lock
+static __inline U32 half_owner_size(char *block_addr)
+{
+    return HF_LOAD_RELAXED(&HEADER(block_addr).size) >> HDR_SIZE;
+}
+
+static __inline U32 half_prev_in_bin(char *block_addr)
+{
+    return LINKS(block_addr).prev_in_bin;
+}
+
+static __inline U32 half_next_in_bin(char *block_addr)
+{
+    return LINKS(block_addr).next_in_bin;
+}
+
+static __inline void half_set_links(char *block_addr, U32 prev_in_bin, U32 next_in_bin)
+{
+    LINKS(block_addr).prev_in_bin = prev_in_bin;
+    LINKS(block_addr).next_in_bin = next_in_bin;
+}
+
+static __inline void half_set_prev_in_bin(char *block_addr, U32 prev_in_bin)
+{
+    LINKS(block_addr).prev_in_bin = prev_in_bin;
+}
+
+static __inline void half_set_next_in_bin(char *block_addr, U32 next_in_bin)
+{
+    LINKS(block_addr).next_in_bin = next_in_bin;
+}
+#else
+static __inline U32 half_field(U32 word, U32 shift)
+{
+    return (word >> shift) & FIELD_MASK;
+}
+
+static __inline U32 half_with_field(U32 word, U32 shift, U32 value)
+{
+    return (word & ~(FIELD_MASK << shift)) | ((value & FIELD_MASK) << shift);
+}
+
+static __inline half_header_t half_make_header(U32 prev_in_mem, U32 next_in_mem, U32 size, BOOL allocated)
+{
+    return ((prev_in_mem & FIELD_MASK) << HDR_PREV) | ((next_in_mem & FIELD_MASK) << HDR_NEXT)
+         | ((size & FIELD_MASK) << HDR_SIZE) | (allocated ? HDR_ALLOCATED : 0);
+}
+
+static __inline U32 half_prev_of(half_header_t header)
+{
+    return half_field(header, HDR_PREV);
+}
+
+static __inline U32 half_next_of(half_fit_t *hf, half_header_t header, U32 offset)
+{
+    (void)hf;
+    (void)offset;
+    return half_field(header, HDR_NEXT);
+}
+
+static __inline U32 half_size_of(half_header_t header)
+{
+    U32 size = half_field(header, HDR_SIZE);
+
+    return (size == 0) ? 1024 : size;
+}
+
+static __inline BOOL half_is_allocated(half_header_t header)
+{
+    return (header & HDR_ALLOCATED) != 0;
+}
+
+static __inline BOOL half_is_zero(half_header_t header)
+{
+    return (header & (HDR_ALLOCATED | HDR_ZERO)) == HDR_ZERO;
+}
+
+static __inline void half_mark_zero(char *block_addr)
+{
+    HEADER(block_addr) |= HDR_ZERO;
+}
+
+static __inline void half_set_prev(char *block_addr, U32 prev_in_mem)
+{
+    HF_STORE_RELAXED(&HEADER(block_addr), half_with_field(HEADER(block_addr), HDR_PREV, prev_in_mem));
+}
+
+//size of an allocated block, read by its owner without holding any lock
+static __inline U32 half_owner_size(char *block_addr)
+{
+    return half_size_of(HF_LOAD_RELAXED(&HEADER(block_addr)));
+}
+
+static __inline U32 half_prev_in_bin(char *block_addr)
+{
+    return half_field(LINKS(block_addr), BIN_PREV);
+}
+
+static __inline U32 half_next_in_bin(char *block_addr)
+{
+    return half_field(LINKS(block_addr), BIN_NEXT);
+}
+
+static __inline void half_set_links(char *block_addr, U32 prev_in_bin, U32 next_in_bin)
+{
+    LINKS(block_addr) = (prev_in_bin << BIN_PREV) | (next_in_bin << BIN_NEXT);
+}
+
+static __inline void half_set_prev_in_bin(char *block_addr, U32 prev_in_bin)
+{
+    LINKS(block_addr) = half_with_field(LINKS(block_addr), BIN_PREV, prev_in_bin);
+}
+
+static __inline void half_set_next_in_bin(char *block_addr, U32 next_in_bin)
+{
+    LINKS(block_addr) = half_with_field(LINKS(block_addr), BIN_NEXT, next_in_bin);
+}
+#endif
+
+static __inline U32 half_offset_of(half_fit_t *hf, char *block_addr)
+{
+    return (U32)((size_t)(block_addr - hf->base_address) >> 5);
+}
+
+static __inline char *half_address_of(half_fit_t *hf, U32 offset)
+{
+    return hf->base_address + ((size_t)offset << 5);
+}
+
+/*
+    Bins. Size class i holds the free blocks of 2^i to 2^(i+1)-1 units, and bit i of bin_bitmap is set while it has
+    any. Classic Half-Fit has one bin per class. With sub-bins each class is split further by the SUB_BIN_BITS
+    bits of the size after its leading one (classes smaller than that use only some of their sub-bins), bin b
+    being sub-bin b % SUB_BINS of class b / SUB_BINS, and sub_bitmaps[i] has a bit per sub-bin of class i.
+*/
+#define SUB_BIN_BITS    HALF_FIT_SUB_BIN_BITS
+#define SUB_BINS        (1u << SUB_BIN_BITS)
+
+#if SUB_BIN_BITS > 5
+#error "HALF_FIT_SUB_BIN_BITS must be 5 or less"
+#endif
+
+//the bin of a free block of 'size' units
+static __inline U32 half_bin_of(U32 size)
+{
+    U32 cls = 31 - HF_CLZ(size);
+#if SUB_BIN_BITS
+    U32 sub = (cls >= SUB_BIN_BITS) ? size >> (cls - SUB_BIN_BITS) : size << (SUB_BIN_BITS - cls);
+
+    return (cls << SUB_BIN_BITS) | (sub & (SUB_BINS - 1));
+#else
+    return cls;
+#endif
+}
+
+static __inline BOOL half_bin_used(half_fit_t *hf, U32 bin)
+{
+#if SUB_BIN_BITS
+    return (hf->sub_bitmaps[bin >> SUB_BIN_BITS] >> (bin & (SUB_BINS - 1))) & 1;
+#else
+    return (hf->bin_bitmap >> bin) & 1;
+#endif
+}
+
+//the first non-empty bin from 'bin' on, NO_BLOCK if there is none: two bit scans at most
+static __inline U32 half_bin_from(half_fit_t *hf, U32 bin)
+{
+#if SUB_BIN_BITS
+    U32 cls = bin >> SUB_BIN_BITS;
+    U32 subs, classes;
+
+    //the bin past the last sub-bin of the top class, which a request just short of the biggest block asks for
+    if(cls >= HALF_FIT_BINS){
+        return NO_BLOCK;
+    }
+    subs = hf->sub_bitmaps[cls] & (~0u << (bin & (SUB_BINS - 1)));
+    if(subs != 0){
+        return (cls << SUB_BIN_BITS) | HF_CTZ(subs);
     }
-    bin_ptrs[10] = base_address; //point the initial bin to block size 32768 (32*1024)
+    classes = hf->bin_bitmap & (~0u << (cls + 1)) & ((1u << HALF_FIT_BINS) - 1);
+    if(classes == 0){
+        return NO_BLOCK;
+    }
+    cls = HF_CTZ(classes);
+    return (cls << SUB_BIN_BITS) | HF_CTZ(hf->sub_bitmaps[cls]);
+#else
+    U32 classes = (bin >= HALF_FIT_BINS) ? 0 : hf->bin_bitmap & (~0u << bin) & ((1u << HALF_FIT_BINS) - 1);
+
+    return (classes == 0) ? NO_BLOCK : HF_CTZ(classes);
+#endif
+}
 
-    half_init_unallocated_block (base_address);
+//the last non-empty bin, whose head is the largest free block but for at most a factor of 1 + 2^-SUB_BIN_BITS;
+//the arena must have a free block
+static __inline U32 half_top_bin(half_fit_t *hf)
+{
+    U32 cls = 31 - HF_CLZ(hf->bin_bitmap);
 
+#if SUB_BIN_BITS
+    return (cls << SUB_BIN_BITS) | (31 - HF_CLZ(hf->sub_bitmaps[cls]));
+#else
+    return cls;
+#endif
 }
 
-void half_alloc_helper(char *block_addr, U32 bin_index){
-    U32 next_block_in_current_bin;
-    char *nextBlockInCurrentBin;
-    char *temp;
+//puts a free block at the head of the bin matching its size
+static void half_bin_insert(half_fit_t *hf, char *block_addr, U32 offset, U32 size)
+{
+    U32 bin_index = half_bin_of(size);
+    U32 head;
+
+    if(half_bin_used(hf, bin_index)){
+        head = hf->bin_heads[bin_index];
+        half_set_links(block_addr, offset, head);
+        half_set_prev_in_bin(half_address_of(hf, head), offset);
+    } else {
+        half_set_links(block_addr, offset, offset);
+#if SUB_BIN_BITS
+        hf->sub_bitmaps[bin_index >> SUB_BIN_BITS] |= 1u << (bin_index & (SUB_BINS - 1));
+#endif
+        hf->bin_bitmap |= 1u << (bin_index >> SUB_BIN_BITS);
+    }
+    hf->bin_heads[bin_index] = offset;
+    hf->free_units += size;
+}
 
-    //update the bin so that it it now points to the next block in that bin
-    next_block_in_current_bin = (((U32)(*(block_addr + 5) & 00111111)) << 4) + (((U32)(*(block_addr + 6) & 11110000)) >> 6); //between 0 and 1023
-    nextBlockInCurrentBin = ((char *) next_block_in_current_bin);
+//unlinks a free block from its bin, wherever it is in the list
+static void half_bin_remove(half_fit_t *hf, char *block_addr, U32 offset, U32 size)
+{
+    U32 bin_index = half_bin_of(size);
+    U32 prev_in_bin = half_prev_in_bin(block_addr);
+    U32 next_in_bin = half_next_in_bin(block_addr);
 
-    if(nextBlockInCurrentBin == block_addr){
-        bin_ptrs[bin_index] = NULL;
+    hf->free_units -= size;
+    if(prev_in_bin == offset){
+        //the block is the head of its bin
+        if(next_in_bin == offset){
+            //the bin is now empty, and maybe its whole class
+#if SUB_BIN_BITS
+            hf->sub_bitmaps[bin_index >> SUB_BIN_BITS] &= ~(1u << (bin_index & (SUB_BINS - 1)));
+            if(hf->sub_bitmaps[bin_index >> SUB_BIN_BITS] == 0){
+                hf->bin_bitmap &= ~(1u << (bin_index >> SUB_BIN_BITS));
+            }
+#else
+            hf->bin_bitmap &= ~(1u << bin_index);
+#endif
+        } else {
+            half_set_prev_in_bin(half_address_of(hf, next_in_bin), next_in_bin);
+            hf->bin_heads[bin_index] = next_in_bin;
+        }
+    } else if(next_in_bin == offset){
+        //the block is the tail of its bin, so its predecessor becomes the tail
+        half_set_next_in_bin(half_address_of(hf, prev_in_bin), prev_in_bin);
     } else {
-        bin_ptrs[bin_index] = (next_block_in_current_bin << 5) + base_address;
+        half_set_next_in_bin(half_address_of(hf, prev_in_bin), next_in_bin);
+        half_set_prev_in_bin(half_address_of(hf, next_in_bin), prev_in_bin);
+    }
+}
+
+#if HALF_FIT_STATS
+//called whenever units leave the bins for good
+static __inline void half_stat_taken(half_fit_t *hf)
+{
+    if(hf->size - hf->free_units > hf->high_water){
+        hf->high_water = hf->size - hf->free_units;
+    }
+}
+#endif
+
+int half_init_arena(half_fit_t *hf, void *mem, size_t len)
+{
+    char *base = (char *)mem;
+    size_t skew = (size_t)base & (HALF_FIT_MIN_ALIGN - 1);
+
+    //headers are accessed as whole words, so the first block has to start on a word boundary (and on a 16 byte
+    //boundary when all memory handed out must be 16 byte aligned)
+    if(skew != 0){
+        if(len < HALF_FIT_MIN_ALIGN - skew){
+            return -1;
+        }
+        base += HALF_FIT_MIN_ALIGN - skew;
+        len -= HALF_FIT_MIN_ALIGN - skew;
+    }
 
-        //For the next block available in the bin, we must update the previous ptr to point to itself
-        //the previous ptr is represented by bits 32-42
-        *(nextBlockInCurrentBin + 4) = (char *)(next_block_in_current_bin >> 2);
-        *(nextBlockInCurrentBin + 5) = (char *)((((next_block_in_current_bin & 0000000011)) << 6) + ((U32)(*(nextBlockInCurrentBin + 5) & 00111111))) ;
+    //the header can only describe HALF_FIT_MAX_UNITS units, anything past that is left unused
+    if(len < 32){
+        return -1;
     }
+    hf->base_address = base;
+    hf->size = (len >> 5 >= HALF_FIT_MAX_UNITS) ? HALF_FIT_MAX_UNITS : (U32)(len >> 5);
+    hf->bins = 32 - HF_CLZ(hf->size); //the arena-sized block lands in the last of these
+#if HALF_FIT_THREAD_SAFE
+    hf->owner = NULL;
+#endif
+#if HALF_FIT_STATS
+    hf->splits = 0;
+    hf->coalesces = 0;
+    hf->failed_allocs = 0;
+#endif
+
+    half_reset_arena(hf);
+    return 0;
+}
 
-    //update the bit in the block so that it is indicates allocated without affecting the remaining bits in that 4th header byte
-    *(block_addr + 3) = (*(block_addr + 3) & 11111100) | 00000010;
+//forgets every allocation in the arena at once: the whole region becomes a single free block again
+void half_reset_arena(half_fit_t *hf)
+{
+#if HALF_FIT_SLAB
+    U32 i;
 
+#endif
+    hf->bin_bitmap = 0; //a bin head is only looked at while its bit is set, so the stale heads can stay
+#if SUB_BIN_BITS
+    memset(hf->sub_bitmaps, 0, sizeof(hf->sub_bitmaps));
+#endif
+    hf->free_units = 0;
+    HF_STAT(hf->high_water = 0);
+#if HALF_FIT_THREAD_SAFE
+    hf->remote_frees = NULL;
+    hf->remote_pending = NULL;
+#endif
+
+    //a single free block whose memory neighbours are itself
+    HEADER(hf->base_address) = half_make_header(0, 0, hf->size, __FALSE);
+    half_bin_insert(hf, hf->base_address, 0, hf->size);
+#if HALF_FIT_SLAB
+    for(i = 0; i < HALF_FIT_SLAB_CLASSES; ++i){
+        hf->slab_heads[i] = NO_BLOCK;
+    }
+    hf->slab_map = NO_BLOCK;
+    hf->slabs = 0;
+#endif
+}
 
+//size of an n byte request in whole units, including the mandatory header, written so that it cannot wrap around
+static __inline U32 half_units_for(U32 n)
+{
+    return (n >> 5) + (((n & 31) + HALF_FIT_HEADER_SIZE + 31) >> 5);
 }
 
-char *half_alloc( U32 n) {
-    U32 bin_index;
+//takes a block of exactly 'units' units out of the bins, splitting off whatever is left over, and marks it allocated
+//returns the address of its header, or NULL when no free block is big enough. Unless 'zeroed' is NULL it is set to
+//whether the block's memory is zero but for the bin links at its start
+static char *half_take_block( half_fit_t *hf, U32 units, BOOL *zeroed) {
+    U32 bin_index, lower, cls;
+    BOOL exact;
     char *mem_block;
     U32 mem_block_size; //size of the available memory block
+    U32 offset, next_in_mem, remainder;
+    half_header_t header;
 
-    n += 4; //including the size of the mandatory 4 byte header
-
-    //Determining the index of the bin that we want to start looking in
-    if(n < 32)
+    //a request larger than the whole arena can never be satisfied
+    if(units > hf->size)
     {
-        bin_index = 0;
+        return NULL;
     }
-    else
-    {
-        bin_index = ceil(log(n)/log(2)) - 5;
 
-        //if the index is greater than 10, we cannot allocate that memory so we return null
-        if (bin_index > 10)
-        {
+    //Determining the index of the bin that we want to start looking in
+    //every block in the bin of 'units' is big enough if 'units' is the smallest size that bin holds (a power of two
+    //in classic Half-Fit), and every block in the bins after it is
+    lower = half_bin_of(units);
+    cls = 31 - HF_CLZ(units);
+    exact = (units & (((1u << cls) - 1) >> SUB_BIN_BITS)) == 0;
+
+    //the first non-empty bin from there on is found with a bit scan of the bitmaps
+    bin_index = half_bin_from(hf, exact ? lower : lower + 1);
+    if(bin_index == NO_BLOCK){
+        //no block is guaranteed to fit, but the head of the bin of 'units' might still be big enough; checking it
+        //is one more header read and lets an arena whose size is not a power of two hand out its biggest block
+        if(exact || !half_bin_used(hf, lower)
+            || half_size_of(HEADER(half_address_of(hf, hf->bin_heads[lower]))) < units){
             return NULL;
         }
-    }
-    //at this point, bin_index will definitely have a value
-
-    //now that we know what bin to start looking into, we should look into that bin for an available memory block
-    //if the bin is empty, we should look in the bin of the next size greater than that
-    //we should continue to do this until all bins have been traversed
-    //checking to see if the current bin to look in is empty
-    while (bin_ptrs[bin_index] == NULL && bin_index < 11){
-        bin_index++;
-    }
-    //we have now found the bin that we can retrieve a block of memory to allocate from or we have bin_index = 11 in which case we cannot allocate any memory
-    if(bin_index == 11){
-        return NULL;
+        bin_index = lower;
     }
     //at this point, we have established that there is a bin with an available block of memory that we can allocate
 
     /*
-     if available_mem_block_size - n < 32, allocate the entire block
-     if available_mem_block_size - n >= 32, split the block into a two blocks:
-        - one with size = smallest multiple of 32 that is greater than n
-        - second with size = size of the entire block - size of the first block
-
-        - then we allocate the 1st block
-        - place the second block into a bin that it corresponds to
+     if available_mem_block_size - units == 0, allocate the entire block
+     otherwise, split the block into a two blocks:
+        - one with size = units, which we allocate
+        - second with size = size of the entire block - units, which goes back into the bin that it corresponds to
 
         --> When we allocate a block of memory, we must:
             - update the bin so that it it now points to the next block in that bin
-            - we DO NOT need to touch the next ptr and prev ptr in memory because they do not change
-            - update the previous ptr of the next block in the memory to point to itself
             - update the bit in the header that indicates that the block is allocated
-            - allocate the first available block in that bin
-        --> When we split a block of memory into two blocks as mentioned above, we must:
-            - update the next and previous memory ptrs each block before or after the two new blocks
-            - update the bin that the original block (the block before we split it) came from so that it now points to the
-              next block in that bin
-            - initialize the header for each of the two new blocks
-            - allocate the first block that we split
-            - deallocate the second block (NOTE: the block was never allocated but in order to reassign it into an appropriate
-              bin, we can treat it as though it is being deallocated
+        --> When we split a block of memory into two blocks as mentioned above, we must also:
+            - initialize the header of the second block: its previous block in memory is the first block and its
+              next block in memory is whatever followed the original block
+            - point the previous ptr of the block after the original block at the second block
+            - shrink the first block and point its next ptr at the second block
+            - put the second block into its bin
+     every step touches a fixed number of headers, so the whole allocation is O(1)
     */
 
     //let's start by getting the pointer to the block of memory we want to allocate
-    mem_block = bin_ptrs[bin_index];
+    offset = hf->bin_heads[bin_index];
+    mem_block = half_address_of(hf, offset);
+    header = HEADER(mem_block);
+    mem_block_size = half_size_of(header);
+    half_bin_remove(hf, mem_block, offset, mem_block_size);
 
-    // Now to perform the appropriate memory allocations
-    //Retrieving the size of the memory block we will be allocating/splitting
-    mem_block_size = (((U32)((*(mem_block + 2)) & 00001111)) << 6) + (((U32)((*(mem_block + 3)) & 11111100)) >> 4);
-    printf("SIZE: %d \n", mem_block_size);
-    if(mem_block_size == 0){
-        mem_block_size = 1024;
-    }
-    printf("SIZE: %d", mem_block_size);
+    if(mem_block_size > units) {
+        //split the block into two and give the remainder back to the bins
+        next_in_mem = half_next_of(hf, header, offset);
+        remainder = offset + units;
 
-    if((mem_block_size*32 - n) < 32) {
-        half_alloc_helper (mem_block, bin_index);
-        return mem_block;
+        if(next_in_mem == offset){
+            //the original block was the last one in memory, so the remainder now is
+            HEADER(half_address_of(hf, remainder)) = half_make_header(offset, remainder, mem_block_size - units, __FALSE);
+        } else {
+            HEADER(half_address_of(hf, remainder)) = half_make_header(offset, next_in_mem, mem_block_size - units, __FALSE);
+            half_set_prev(half_address_of(hf, next_in_mem), remainder);
+        }
+        if(half_is_zero(header)){
+            half_mark_zero(half_address_of(hf, remainder));
+        }
+        half_bin_insert(hf, half_address_of(hf, remainder), remainder, mem_block_size - units);
+        HF_STAT(hf->splits++);
+
+        HF_SIZE_FENCE();
+        HEADER(mem_block) = half_make_header(half_prev_of(header), remainder, units, __TRUE);
     } else {
-        //split the block into two and then allocate it
+        HEADER(mem_block) = half_make_header(half_prev_of(header), half_next_of(hf, header, offset), mem_block_size, __TRUE);
+    }
+    HF_STAT(half_stat_taken(hf));
+    if(zeroed != NULL){
+        *zeroed = half_is_zero(header);
     }
 
+    return mem_block;
 }
 
 /*
@@ -168,13 +654,3029 @@ char *half_alloc( U32 n) {
        -> First check which one is free (either left or right of the current block being deallocated)
        -> Then we need to combine the headers into one header containing the new information.
           -> If the new combined block is at the end of the 1024 size initial block, the pointer to the next block
-             in memory will be assigned to itself (?? or zero?)
+             in memory will be assigned to itself
           -> If the new combined block is in the middle of the initialized block (between other allocated blocks),
              Then depending on whether the other block that is free (next to the one being deallocated) is to the
              left or right of the block being deallocated, we have to update the pointer to the previous or next
              memory block
           -> Update the size of the new, combined block (remember to add the previous size of the block that we joined
              to the one being deallocated.
+    Free neighbours are taken out of their bins before merging and the merged block is put back in at the end. There
+    are at most two neighbours, so the whole deallocation is O(1).
+*/
+
+static void half_release_block( half_fit_t *hf, char *block_addr)
+{
+    char *neighbour;
+    U32 offset, size, prev_in_mem, next_in_mem, after_next;
+    half_header_t header, neighbour_header;
+
+    offset = half_offset_of(hf, block_addr);
+    header = HEADER(block_addr);
+    size = half_size_of(header);
+    prev_in_mem = half_prev_of(header);
+    next_in_mem = half_next_of(hf, header, offset);
+
+    //merge with the block to the right
+    if(next_in_mem != offset){
+        neighbour = half_address_of(hf, next_in_mem);
+        neighbour_header = HEADER(neighbour);
+
+        if(!half_is_allocated(neighbour_header)){
+            half_bin_remove(hf, neighbour, next_in_mem, half_size_of(neighbour_header));
+            size += half_size_of(neighbour_header);
+            after_next = half_next_of(hf, neighbour_header, next_in_mem);
+            HF_STAT(hf->coalesces++);
+
+            if(after_next == next_in_mem){
+                next_in_mem = offset; //the right neighbour was the last block in memory
+            } else {
+                next_in_mem = after_next;
+                half_set_prev(half_address_of(hf, after_next), offset);
+            }
+        }
+    }
+
+    //merge with the block to the left; the left block absorbs this one
+    if(prev_in_mem != offset){
+        neighbour = half_address_of(hf, prev_in_mem);
+        neighbour_header = HEADER(neighbour);
+
+        if(!half_is_allocated(neighbour_header)){
+            half_bin_remove(hf, neighbour, prev_in_mem, half_size_of(neighbour_header));
+            size += half_size_of(neighbour_header);
+            HF_STAT(hf->coalesces++);
+
+            if(next_in_mem == offset){
+                next_in_mem = prev_in_mem; //the left block is now the last block in memory
+            } else {
+                half_set_prev(half_address_of(hf, next_in_mem), prev_in_mem);
+            }
+            block_addr = neighbour;
+            offset = prev_in_mem;
+            prev_in_mem = half_prev_of(neighbour_header);
+        }
+    }
+
+    HEADER(block_addr) = half_make_header(prev_in_mem, next_in_mem, size, __FALSE);
+    half_bin_insert(hf, block_addr, offset, size);
+}
+
+//splits an allocated block in two allocated blocks, the first one 'units' units long, and returns the second one
+static char *half_split_allocated(half_fit_t *hf, char *block_addr, U32 units)
+{
+    U32 offset = half_offset_of(hf, block_addr);
+    half_header_t header = HEADER(block_addr);
+    U32 next_in_mem = half_next_of(hf, header, offset);
+    U32 tail = offset + units;
+
+    if(next_in_mem == offset){
+        HEADER(half_address_of(hf, tail)) = half_make_header(offset, tail, half_size_of(header) - units, __TRUE);
+    } else {
+        HEADER(half_address_of(hf, tail)) = half_make_header(offset, next_in_mem, half_size_of(header) - units, __TRUE);
+        half_set_prev(half_address_of(hf, next_in_mem), tail);
+    }
+    HF_SIZE_FENCE();
+    HEADER(block_addr) = half_make_header(half_prev_of(header), tail, units, __TRUE);
+    return half_address_of(hf, tail);
+}
+
+#if HALF_FIT_SLAB
+/*
+    Slabs. Requests of up to HALF_FIT_SLAB_MAX bytes are not given a block of their own: they get a slot of 8, 16, 24
+    or 32 bytes in a slab, a block of HALF_FIT_SLAB_UNITS units whose offset is a multiple of its size. The first unit
+    of a slab holds its block header and a half_slab_t; the rest is cut into equal slots without any per-slot header.
+    In 16 byte alignment mode only the 16 and 32 byte sizes are used.
+    A bit per slab sized chunk of the arena (the slab map, an ordinary block taken when the first slab is made and
+    given back with the last one) says whether the chunk is a slab, so half_free_to can route any pointer with one bit
+    test. Slabs with free slots are kept on one list per size. A slab that empties completely goes back to the bins
+    unless it is the last one of its size; those are given back only when an allocation would otherwise fail.
 */
+typedef struct half_slab {
+    U32 free_slots[2];  //bit i is set while slot i is free
+    U32 prev_slab;      //neighbours on the list of slabs of the same size with free slots, NO_BLOCK at either end
+    U32 next_slab;
+    U32 cls;            //slot size is (cls + 1) * 8 bytes
+    U32 used;           //slots handed out
+} half_slab_t;
+
+#define SLAB_BYTES          (HALF_FIT_SLAB_UNITS << 5)
+#define SLAB(slab_addr)     (*(half_slab_t *)((slab_addr) + HALF_FIT_HEADER_SIZE))
+#define SLOT_BYTES(cls)     (((cls) + 1) << 3)
+#define SLOTS_AT            ((HALF_FIT_HEADER_SIZE + sizeof(half_slab_t) + 15) & ~15u) //the first slot, 32 or 48
+#define SLOTS(cls)          ((SLAB_BYTES - SLOTS_AT) / SLOT_BYTES(cls))
+
+static __inline U32 *half_slab_map(half_fit_t *hf)
+{
+    return (U32 *)(half_address_of(hf, hf->slab_map) + HALF_FIT_HEADER_SIZE);
+}
+
+static __inline BOOL half_in_slab(half_fit_t *hf, char *mem_block)
+{
+    U32 chunk = (U32)((size_t)(mem_block - hf->base_address) / SLAB_BYTES);
+
+    return hf->slab_map != NO_BLOCK && ((half_slab_map(hf)[chunk >> 5] >> (chunk & 31)) & 1);
+}
+
+static __inline void half_slab_mark(half_fit_t *hf, U32 offset)
+{
+    U32 chunk = offset / HALF_FIT_SLAB_UNITS;
+
+    half_slab_map(hf)[chunk >> 5] ^= 1u << (chunk & 31);
+}
+
+static void half_slab_unlink(half_fit_t *hf, char *slab_addr)
+{
+    half_slab_t *slab = &SLAB(slab_addr);
+
+    if(slab->prev_slab == NO_BLOCK){
+        hf->slab_heads[slab->cls] = slab->next_slab;
+    } else {
+        SLAB(half_address_of(hf, slab->prev_slab)).next_slab = slab->next_slab;
+    }
+    if(slab->next_slab != NO_BLOCK){
+        SLAB(half_address_of(hf, slab->next_slab)).prev_slab = slab->prev_slab;
+    }
+}
+
+static void half_slab_push(half_fit_t *hf, char *slab_addr, U32 offset)
+{
+    half_slab_t *slab = &SLAB(slab_addr);
+    U32 head = hf->slab_heads[slab->cls];
+
+    slab->prev_slab = NO_BLOCK;
+    slab->next_slab = head;
+    if(head != NO_BLOCK){
+        SLAB(half_address_of(hf, head)).prev_slab = offset;
+    }
+    hf->slab_heads[slab->cls] = offset;
+}
+
+//takes a block of 'units' units whose offset is a multiple of 'align_units' (a power of two); the slack in front of
+//and behind it goes straight back to the bins
+static char *half_take_aligned(half_fit_t *hf, U32 units, U32 align_units)
+{
+    char *block_addr = half_take_block(hf, units + align_units - 1, NULL);
+    char *aligned;
+    U32 lead;
+
+    if(block_addr == NULL){
+        return NULL;
+    }
+
+    lead = (0u - half_offset_of(hf, block_addr)) & (align_units - 1);
+    if(lead != 0){
+        aligned = half_split_allocated(hf, block_addr, lead);
+        half_release_block(hf, block_addr);
+        block_addr = aligned;
+    }
+    if(half_size_of(HEADER(block_addr)) > units){
+        half_release_block(hf, half_split_allocated(hf, block_addr, units));
+    }
+    return block_addr;
+}
+
+//makes a new, empty slab for slots of class 'cls' and puts it on its list; returns NULL when the heap is too full
+static char *half_slab_create(half_fit_t *hf, U32 cls)
+{
+    U32 words = ((hf->size + HALF_FIT_SLAB_UNITS - 1) / HALF_FIT_SLAB_UNITS + 31) >> 5;
+    U32 slots = SLOTS(cls);
+    char *slab_addr;
+    half_slab_t *slab;
+    U32 i;
+
+    if(hf->slab_map == NO_BLOCK){
+        slab_addr = half_take_block(hf, half_units_for(words << 2), NULL);
+        if(slab_addr == NULL){
+            return NULL;
+        }
+        hf->slab_map = half_offset_of(hf, slab_addr);
+        for(i = 0; i < words; ++i){
+            half_slab_map(hf)[i] = 0;
+        }
+    }
+
+    slab_addr = half_take_aligned(hf, HALF_FIT_SLAB_UNITS, HALF_FIT_SLAB_UNITS);
+    if(slab_addr == NULL){
+        if(hf->slabs == 0){
+            half_release_block(hf, half_address_of(hf, hf->slab_map));
+            hf->slab_map = NO_BLOCK;
+        }
+        return NULL;
+    }
+    half_slab_mark(hf, half_offset_of(hf, slab_addr));
+    hf->slabs++;
+
+    slab = &SLAB(slab_addr);
+    slab->free_slots[0] = (slots >= 32) ? ~0u : (1u << slots) - 1;
+    slab->free_slots[1] = (slots <= 32) ? 0 : (1u << (slots - 32)) - 1;
+    slab->cls = cls;
+    slab->used = 0;
+    half_slab_push(hf, slab_addr, half_offset_of(hf, slab_addr));
+    return slab_addr;
+}
+
+//gives an empty slab back to the bins, and the slab map with the last slab
+static void half_slab_destroy(half_fit_t *hf, char *slab_addr)
+{
+    half_slab_unlink(hf, slab_addr);
+    half_slab_mark(hf, half_offset_of(hf, slab_addr));
+    half_release_block(hf, slab_addr);
+    if(--hf->slabs == 0){
+        half_release_block(hf, half_address_of(hf, hf->slab_map));
+        hf->slab_map = NO_BLOCK;
+    }
+}
+
+//gives back the empty slabs kept at the head of each list; returns __FALSE if there were none
+static BOOL half_slab_trim(half_fit_t *hf)
+{
+    BOOL trimmed = __FALSE;
+    char *slab_addr;
+    U32 cls;
+
+    for(cls = 0; cls < HALF_FIT_SLAB_CLASSES; ++cls){
+        if(hf->slab_heads[cls] != NO_BLOCK){
+            slab_addr = half_address_of(hf, hf->slab_heads[cls]);
+            if(SLAB(slab_addr).used == 0){
+                half_slab_destroy(hf, slab_addr);
+                trimmed = __TRUE;
+            }
+        }
+    }
+    return trimmed;
+}
 
-void  half_free( char * mem_block);
+static __inline U32 half_slab_class(U32 n)
+{
+    U32 cls = (n == 0) ? 0 : (n - 1) >> 3;
+
+#if HALF_FIT_ALIGN_16
+    cls |= 1; //slots of 16 and 32 bytes only, so every slot stays 16 byte aligned
+#endif
+    return cls;
+}
+
+static char *half_slab_alloc(half_fit_t *hf, U32 cls)
+{
+    char *slab_addr;
+    half_slab_t *slab;
+    U32 slot;
+
+    if(hf->slab_heads[cls] == NO_BLOCK){
+        slab_addr = half_slab_create(hf, cls);
+        if(slab_addr == NULL){
+            return NULL;
+        }
+    } else {
+        slab_addr = half_address_of(hf, hf->slab_heads[cls]);
+    }
+    slab = &SLAB(slab_addr);
+
+    if(slab->free_slots[0] != 0){
+        slot = HF_CTZ(slab->free_slots[0]);
+        slab->free_slots[0] &= slab->free_slots[0] - 1;
+    } else {
+        slot = 32 + HF_CTZ(slab->free_slots[1]);
+        slab->free_slots[1] &= slab->free_slots[1] - 1;
+    }
+    if(++slab->used == SLOTS(cls)){
+        half_slab_unlink(hf, slab_addr); //full slabs are off the list until a slot comes back
+    }
+    return slab_addr + SLOTS_AT + slot * SLOT_BYTES(cls);
+}
+
+static void half_slab_free(half_fit_t *hf, char *mem_block)
+{
+    char *slab_addr = hf->base_address + ((size_t)(mem_block - hf->base_address) & ~(size_t)(SLAB_BYTES - 1));
+    half_slab_t *slab = &SLAB(slab_addr);
+    U32 slot = (U32)(mem_block - slab_addr - SLOTS_AT) / SLOT_BYTES(slab->cls);
+
+    slab->free_slots[slot >> 5] |= 1u << (slot & 31);
+
+    if(slab->used-- == SLOTS(slab->cls)){
+        half_slab_push(hf, slab_addr, half_offset_of(hf, slab_addr));
+    } else if(slab->used == 0 && (slab->prev_slab != NO_BLOCK || slab->next_slab != NO_BLOCK)){
+        half_slab_destroy(hf, slab_addr);
+    }
+}
+#endif
+
+/*
+    Aligned blocks. The memory of a block normally starts right after its header. An aligned block may start its
+    memory further in; the word right before that memory then is a pad word holding the distance back to the block
+    with PAD_FLAG set. Bit 0 of the word right before the memory of an ordinary block is always clear, since that
+    word belongs to its header, so one load tells the two apart.
+*/
+#define PAD_FLAG    0x1u
+
+//the header address of the block whose memory mem_block is (slab slots have none)
+static __inline char *half_block_of(char *mem_block)
+{
+    U32 pad = HF_LOAD_RELAXED((U32 *)(mem_block - 4));
+
+    return (pad & PAD_FLAG) ? mem_block - (pad & ~PAD_FLAG) : mem_block - HALF_FIT_HEADER_SIZE;
+}
+
+//frees a block of this arena on behalf of the thread that may allocate from it
+static void half_free_local(half_fit_t *hf, char *mem_block)
+{
+#if HALF_FIT_SLAB
+    if(half_in_slab(hf, mem_block)){
+        half_slab_free(hf, mem_block);
+        return;
+    }
+#endif
+    half_release_block(hf, half_block_of(mem_block));
+}
+
+#if HALF_FIT_THREAD_SAFE
+/*
+    Remote frees. An arena claimed by a thread with half_claim_arena is only ever allocated from by that thread, but
+    any thread may free into it. Memory freed by another thread is not touched beyond its first bytes: it is pushed
+    onto the arena's remote_frees stack with one compare-and-swap, without the owner's lock, bins or slabs. The
+    owner moves the whole stack to its private remote_pending list with one exchange and frees that memory for real
+    on its following calls to half_alloc_from, HALF_FIT_REMOTE_BATCH at a time so that no single call pays for a
+    long list (all of it at once if the allocation would otherwise fail).
+*/
+static __thread char half_thread_tag;   //the address of its per-thread copy identifies the calling thread
+#define HF_SELF ((void *)&half_thread_tag)
+
+//the link is copied byte-wise: with a 4 byte header the memory handed out is only word aligned
+static __inline char *half_remote_next(char *mem_block)
+{
+    char *next;
+
+    memcpy(&next, mem_block, sizeof(next));
+    return next;
+}
+
+static void half_remote_push(half_fit_t *hf, char *mem_block)
+{
+    char *head = __atomic_load_n(&hf->remote_frees, __ATOMIC_RELAXED);
+
+    do {
+        memcpy(mem_block, &head, sizeof(head));
+    } while(!__atomic_compare_exchange_n(&hf->remote_frees, &head, mem_block, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+//frees up to 'limit' remotely freed blocks for real; only the owner calls this. Returns __FALSE if there was
+//nothing to free
+static BOOL half_remote_collect(half_fit_t *hf, U32 limit)
+{
+    char *mem_block;
+
+    if(hf->remote_pending == NULL){
+        if(__atomic_load_n(&hf->remote_frees, __ATOMIC_RELAXED) == NULL){
+            return __FALSE;
+        }
+        hf->remote_pending = __atomic_exchange_n(&hf->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    }
+
+    while(hf->remote_pending != NULL && limit-- != 0){
+        mem_block = hf->remote_pending;
+        hf->remote_pending = half_remote_next(mem_block);
+        half_free_local(hf, mem_block);
+    }
+    return __TRUE;
+}
+
+void half_claim_arena(half_fit_t *hf)
+{
+    hf->owner = HF_SELF;
+}
+#endif
+
+void  half_free_to( half_fit_t *hf, char * mem_block)
+{
+    if(mem_block == NULL){
+        return;
+    }
+#if HALF_FIT_THREAD_SAFE
+    if(hf->owner != NULL && hf->owner != HF_SELF){
+        half_remote_push(hf, mem_block);
+        return;
+    }
+#endif
+    half_free_local(hf, mem_block);
+}
+
+//a free that already knows the size: a block for more than HALF_FIT_SLAB_MAX bytes cannot be a slot, and one that
+//was not aligned has no pad word, so neither the slab map nor the word in front of the memory has to be read
+void  half_free_sized_to( half_fit_t *hf, char * mem_block, U32 n)
+{
+    if(mem_block == NULL){
+        return;
+    }
+#if HALF_FIT_THREAD_SAFE
+    if(hf->owner != NULL && hf->owner != HF_SELF){
+        half_remote_push(hf, mem_block);
+        return;
+    }
+#endif
+#if HALF_FIT_SLAB
+    if(n <= HALF_FIT_SLAB_MAX){
+        half_free_local(hf, mem_block);
+        return;
+    }
+#endif
+    (void)n;
+    half_release_block(hf, mem_block - HALF_FIT_HEADER_SIZE);
+}
+
+//gives the allocator's own cached memory back when an allocation is about to fail: blocks other threads freed into
+//a claimed arena, and the empty slab kept for each size. Returns __FALSE if there was nothing to give back
+static BOOL half_reclaim(half_fit_t *hf)
+{
+    BOOL reclaimed = __FALSE;
+
+#if HALF_FIT_THREAD_SAFE
+    reclaimed = half_remote_collect(hf, ~0u);
+#endif
+#if HALF_FIT_SLAB
+    reclaimed = half_slab_trim(hf) || reclaimed;
+#endif
+    (void)hf;
+    return reclaimed;
+}
+
+//half_alloc_from; 'zeroed' as for half_take_block
+static char *half_take_memory(half_fit_t *hf, U32 n, BOOL *zeroed)
+{
+    U32 units = half_units_for(n);
+    char *mem_block;
+
+#if HALF_FIT_THREAD_SAFE
+    half_remote_collect(hf, HALF_FIT_REMOTE_BATCH);
+#endif
+#if HALF_FIT_SLAB
+    if(n <= HALF_FIT_SLAB_MAX){
+        mem_block = half_slab_alloc(hf, half_slab_class(n));
+        if(mem_block != NULL){
+            if(zeroed != NULL){
+                *zeroed = __FALSE;
+            }
+            return mem_block;
+        }
+        //no room for another slab; a block of its own may still fit
+    }
+#endif
+    mem_block = half_take_block(hf, units, zeroed);
+    while(mem_block == NULL && half_reclaim(hf)){
+        mem_block = half_take_block(hf, units, zeroed);
+    }
+    if(mem_block == NULL){
+        HF_STAT(hf->failed_allocs++);
+        return NULL;
+    }
+
+    return mem_block + HALF_FIT_HEADER_SIZE; //the caller's memory starts right after the header
+}
+
+char *half_alloc_from( half_fit_t *hf, U32 n) {
+    return half_take_memory(hf, n, NULL);
+}
+
+/*
+    Zeroed memory. half_calloc only clears what it has to: nothing past the bin links of a block known to be zero,
+    which is where big blocks of a fresh heap come from. Whatever does need clearing, HALF_FIT_STREAM_BYTES or more
+    of it is written with non-temporal stores on SSE2 targets, fenced before the memory is handed out.
+*/
+
+//clears n bytes
+static void half_clear(char *mem, size_t n)
+{
+#if defined(__SSE2__)
+    __m128i zero;
+    size_t head;
+    char *end;
+
+    if(n >= HALF_FIT_STREAM_BYTES){
+        head = (size_t)(-(size_t)mem) & 15;
+        memset(mem, 0, head);
+        mem += head;
+        n -= head;
+        zero = _mm_setzero_si128();
+        for(end = mem + (n & ~(size_t)63); mem != end; mem += 64){
+            _mm_stream_si128((__m128i *)mem, zero);
+            _mm_stream_si128((__m128i *)(mem + 16), zero);
+            _mm_stream_si128((__m128i *)(mem + 32), zero);
+            _mm_stream_si128((__m128i *)(mem + 48), zero);
+        }
+        _mm_sfence();
+        n &= 63;
+    }
+#endif
+    memset(mem, 0, n);
+}
+
+//clears the n bytes of memory just taken: only the bin links at their start if the block was known to be zero
+static __inline void half_clear_taken(char *mem_block, U32 n, BOOL zeroed)
+{
+    half_clear(mem_block, (zeroed && n > sizeof(half_links_t)) ? sizeof(half_links_t) : n);
+}
+
+char *half_calloc_from( half_fit_t *hf, U32 count, U32 size)
+{
+    BOOL zeroed = __FALSE;
+    char *mem_block;
+
+    if(size != 0 && count > ~0u / size){
+        HF_STAT(hf->failed_allocs++);
+        return NULL;
+    }
+    mem_block = half_take_memory(hf, count * size, &zeroed);
+    if(mem_block != NULL){
+        half_clear_taken(mem_block, count * size, zeroed);
+    }
+    return mem_block;
+}
+
+/*
+    Batches. Taking k blocks of the same size one at a time costs k bin lookups, k unlinks and k splits. A batch
+    takes one block of k * units instead and cuts it into k allocated blocks in a single pass over their headers;
+    only the run's two outer neighbours are touched. When no block is big enough for the whole batch the run is cut
+    from the biggest free block there is, and the rest of the batch from the next one.
+    Going the other way, blocks that sit next to each other in memory (in the order they are given) are first
+    merged into one allocated block by rewriting one header, and then freed with a single coalesce. Batches sorted
+    by address therefore go back to the bins as one block per contiguous run.
+*/
+
+//takes up to *count adjacent blocks of 'units' units each with one split. Returns the header address of the first
+//one and stores how many there are in *count, or returns NULL when not even one block fits
+static char *half_take_run(half_fit_t *hf, U32 units, U32 *count)
+{
+    U32 k = *count;
+    U32 largest, offset, next_in_mem, i;
+    char *run;
+    half_header_t header;
+
+    if(units == 0 || units > hf->size || hf->bin_bitmap == 0){
+        return NULL;
+    }
+    if(k > hf->size / units){
+        k = hf->size / units;
+    }
+
+    run = half_take_block(hf, k * units, NULL);
+    if(run == NULL){
+        //cut as much as the head of the highest non-empty bin holds; no free block is twice its size
+        largest = half_size_of(HEADER(half_address_of(hf, hf->bin_heads[half_top_bin(hf)])));
+        k = largest / units;
+        if(k == 0){
+            return NULL;
+        }
+        run = half_take_block(hf, k * units, NULL);
+    }
+
+    //cut the run into k blocks: inner links point at the neighbouring pieces, the last piece inherits the run's
+    //next neighbour. The first piece shrinks last, once the pieces after it exist
+    offset = half_offset_of(hf, run);
+    header = HEADER(run);
+    next_in_mem = half_next_of(hf, header, offset);
+    for(i = 1; i < k; ++i){
+        HEADER(half_address_of(hf, offset + i * units)) = half_make_header(offset + (i - 1) * units,
+            (i == k - 1) ? offset + i * units : offset + (i + 1) * units, units, __TRUE);
+    }
+    if(k > 1 && next_in_mem != offset){
+        HEADER(half_address_of(hf, offset + (k - 1) * units)) = half_make_header(offset + (k - 2) * units,
+            next_in_mem, units, __TRUE);
+        half_set_prev(half_address_of(hf, next_in_mem), offset + (k - 1) * units);
+    }
+    HF_SIZE_FENCE();
+    HEADER(run) = half_make_header(half_prev_of(header), (k == 1) ? next_in_mem : offset + units, units, __TRUE);
+
+    *count = k;
+    return run;
+}
+
+//fills out[] with up to 'count' blocks of 'units' units; returns how many it got
+static U32 half_take_batch(half_fit_t *hf, U32 units, U32 count, char **out)
+{
+    U32 filled = 0;
+    U32 k, i;
+    char *run;
+
+    while(filled < count){
+        k = count - filled;
+        run = half_take_run(hf, units, &k);
+        if(run == NULL){
+            break;
+        }
+        for(i = 0; i < k; ++i){
+            out[filled++] = run + (size_t)i * units * 32 + HALF_FIT_HEADER_SIZE;
+        }
+    }
+    return filled;
+}
+
+//turns the adjacent allocated blocks from 'first' to 'last' into one allocated block
+static void half_merge_run(half_fit_t *hf, char *first, char *last)
+{
+    U32 offset = half_offset_of(hf, first);
+    U32 last_offset = half_offset_of(hf, last);
+    half_header_t last_header = HEADER(last);
+    U32 next_in_mem = half_next_of(hf, last_header, last_offset);
+    U32 size = last_offset + half_size_of(last_header) - offset;
+
+    if(next_in_mem == last_offset){
+        HEADER(first) = half_make_header(half_prev_of(HEADER(first)), offset, size, __TRUE);
+    } else {
+        HEADER(first) = half_make_header(half_prev_of(HEADER(first)), next_in_mem, size, __TRUE);
+        half_set_prev(half_address_of(hf, next_in_mem), offset);
+    }
+}
+
+//frees every pointer in ptrs[], merging runs of blocks that follow each other in memory before releasing them
+static void half_release_batch(half_fit_t *hf, char **ptrs, U32 count)
+{
+    char *first = NULL;
+    char *last = NULL;
+    char *block_addr;
+    U32 run_end = 0;
+    U32 i;
+
+    for(i = 0; i < count; ++i){
+        if(ptrs[i] == NULL){
+            continue;
+        }
+#if HALF_FIT_SLAB
+        if(half_in_slab(hf, ptrs[i])){
+            half_slab_free(hf, ptrs[i]);
+            continue;
+        }
+#endif
+        block_addr = half_block_of(ptrs[i]);
+        if(first == NULL || half_offset_of(hf, block_addr) != run_end){
+            if(first != NULL){
+                if(last != first){
+                    half_merge_run(hf, first, last);
+                }
+                half_release_block(hf, first);
+            }
+            first = block_addr;
+        }
+        last = block_addr;
+        run_end = half_offset_of(hf, block_addr) + half_size_of(HEADER(block_addr));
+    }
+
+    if(first != NULL){
+        if(last != first){
+            half_merge_run(hf, first, last);
+        }
+        half_release_block(hf, first);
+    }
+}
+
+U32 half_alloc_batch_from( half_fit_t *hf, U32 n, U32 count, char **out)
+{
+    U32 units = half_units_for(n);
+    U32 filled = 0;
+
+#if HALF_FIT_THREAD_SAFE
+    half_remote_collect(hf, HALF_FIT_REMOTE_BATCH);
+#endif
+#if HALF_FIT_SLAB
+    if(n <= HALF_FIT_SLAB_MAX){
+        //slots are already cheap one at a time
+        while(filled < count && (out[filled] = half_alloc_from(hf, n)) != NULL){
+            filled++;
+        }
+        return filled;
+    }
+#endif
+    filled = half_take_batch(hf, units, count, out);
+    while(filled < count && half_reclaim(hf)){
+        filled += half_take_batch(hf, units, count - filled, out + filled);
+    }
+    if(filled < count){
+        HF_STAT(hf->failed_allocs++);
+    }
+    return filled;
+}
+
+void  half_free_batch_to( half_fit_t *hf, char **ptrs, U32 count)
+{
+#if HALF_FIT_THREAD_SAFE
+    U32 i;
+
+    if(hf->owner != NULL && hf->owner != HF_SELF){
+        for(i = 0; i < count; ++i){
+            if(ptrs[i] != NULL){
+                half_remote_push(hf, ptrs[i]);
+            }
+        }
+        return;
+    }
+#endif
+    half_release_batch(hf, ptrs, count);
+}
+
+/*
+    Resizing. A block shrinks in place, its tail going back to the bins (and coalescing with whatever free block
+    follows it). It grows in place when the block right after it in memory is free and the two together are big
+    enough: the neighbour leaves its bin, the block absorbs it and any excess is split off again. Only when neither
+    works is a new block allocated and the contents copied. Every in-place case touches a fixed number of headers.
+*/
+
+//resizes an allocated block to 'units' units without moving it; returns __FALSE if it cannot
+static BOOL half_resize_block(half_fit_t *hf, char *block_addr, U32 units)
+{
+    U32 offset = half_offset_of(hf, block_addr);
+    half_header_t header = HEADER(block_addr);
+    U32 size = half_size_of(header);
+    U32 next_in_mem = half_next_of(hf, header, offset);
+    U32 after_next;
+    char *neighbour;
+    half_header_t neighbour_header;
+
+    if(units > size){
+        if(next_in_mem == offset){
+            return __FALSE; //the last block in memory has nothing to grow into
+        }
+        neighbour = half_address_of(hf, next_in_mem);
+        neighbour_header = HEADER(neighbour);
+        if(half_is_allocated(neighbour_header) || size + half_size_of(neighbour_header) < units){
+            return __FALSE;
+        }
+
+        half_bin_remove(hf, neighbour, next_in_mem, half_size_of(neighbour_header));
+        size += half_size_of(neighbour_header);
+        after_next = half_next_of(hf, neighbour_header, next_in_mem);
+        if(after_next == next_in_mem){
+            HEADER(block_addr) = half_make_header(half_prev_of(header), offset, size, __TRUE);
+        } else {
+            HEADER(block_addr) = half_make_header(half_prev_of(header), after_next, size, __TRUE);
+            half_set_prev(half_address_of(hf, after_next), offset);
+        }
+        HF_STAT(half_stat_taken(hf));
+    }
+
+    if(units < size){
+        half_release_block(hf, half_split_allocated(hf, block_addr, units));
+    }
+    return __TRUE;
+}
+
+char *half_realloc_from( half_fit_t *hf, char *mem_block, U32 n)
+{
+    char *new_block, *block_addr;
+    U32 old_bytes, lead;
+
+    if(mem_block == NULL){
+        return half_alloc_from(hf, n);
+    }
+    if(n == 0){
+        half_free_to(hf, mem_block);
+        return NULL;
+    }
+
+#if HALF_FIT_SLAB
+    if(half_in_slab(hf, mem_block)){
+        old_bytes = SLOT_BYTES(SLAB(hf->base_address
+            + ((size_t)(mem_block - hf->base_address) & ~(size_t)(SLAB_BYTES - 1))).cls);
+        if(n <= old_bytes){
+            return mem_block; //the slot is big enough already
+        }
+    } else
+#endif
+    {
+        //an aligned block keeps its alignment while it stays in place
+        block_addr = half_block_of(mem_block);
+        lead = (U32)(mem_block - block_addr) - HALF_FIT_HEADER_SIZE;
+        if(n <= ~0u - lead && half_resize_block(hf, block_addr, half_units_for(n + lead))){
+            return mem_block;
+        }
+        old_bytes = (half_size_of(HEADER(block_addr)) << 5) - HALF_FIT_HEADER_SIZE - lead;
+    }
+
+    //the last resort: move the contents; the old block stays valid if there is no room for the new one
+    new_block = half_alloc_from(hf, n); //counts the failure, if it is one
+    if(new_block != NULL){
+        memcpy(new_block, mem_block, (old_bytes < n) ? old_bytes : n);
+        half_free_to(hf, mem_block);
+    }
+    return new_block;
+}
+
+//takes a block whose memory, 'n' bytes of it, starts on an 'alignment' byte boundary. Whole units of slack in front
+//of that boundary go back to the bins as a free block of their own, and so does whatever is left behind the memory
+static char *half_take_aligned_memory(half_fit_t *hf, U32 alignment, U32 n)
+{
+    U32 extra = alignment - HALF_FIT_MIN_ALIGN; //the most the memory can have to move forward
+    char *block_addr, *tail, *mem_block;
+    U32 lead, units;
+
+    if(n > ~0u - extra){
+        return NULL;
+    }
+    block_addr = half_take_block(hf, half_units_for(n + extra), NULL);
+    if(block_addr == NULL){
+        return NULL;
+    }
+
+    mem_block = (char *)(((size_t)block_addr + HALF_FIT_HEADER_SIZE + alignment - 1) & ~(size_t)(alignment - 1));
+    lead = (U32)((size_t)(mem_block - HALF_FIT_HEADER_SIZE - block_addr) >> 5);
+    if(lead != 0){
+        tail = half_split_allocated(hf, block_addr, lead);
+        half_release_block(hf, block_addr);
+        block_addr = tail;
+    }
+
+    lead = (U32)(mem_block - block_addr) - HALF_FIT_HEADER_SIZE; //now less than a unit
+    units = half_units_for(n + lead);
+    if(half_size_of(HEADER(block_addr)) > units){
+        half_release_block(hf, half_split_allocated(hf, block_addr, units));
+    }
+    if(lead != 0){
+        *(U32 *)(mem_block - 4) = (U32)(mem_block - block_addr) | PAD_FLAG;
+    }
+    return mem_block;
+}
+
+char *half_aligned_alloc_from( half_fit_t *hf, U32 alignment, U32 n)
+{
+    char *mem_block;
+
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > HALF_FIT_MAX_ALIGN){
+        return NULL;
+    }
+    if(alignment <= HALF_FIT_MIN_ALIGN){
+        return half_alloc_from(hf, n);
+    }
+
+#if HALF_FIT_THREAD_SAFE
+    half_remote_collect(hf, HALF_FIT_REMOTE_BATCH);
+#endif
+    mem_block = half_take_aligned_memory(hf, alignment, n);
+    while(mem_block == NULL && half_reclaim(hf)){
+        mem_block = half_take_aligned_memory(hf, alignment, n);
+    }
+    if(mem_block == NULL){
+        HF_STAT(hf->failed_allocs++);
+    }
+    return mem_block;
+}
+
+#if HALF_FIT_PER_CPU || HALF_FIT_GROW
+//takes 'n' bytes aligned to 'alignment' from an arena of the default heap, or zeroed ones when 'zero' is set
+static __inline char *half_take_from(half_fit_t *hf, U32 alignment, U32 n, BOOL zero)
+{
+    return zero ? half_calloc_from(hf, 1, n) : half_aligned_alloc_from(hf, alignment, n);
+}
+#endif
+
+#if HALF_FIT_PER_CPU
+#if !HALF_FIT_THREAD_SAFE
+#error "HALF_FIT_PER_CPU needs HALF_FIT_THREAD_SAFE"
+#endif
+/*
+    In per-CPU builds the default heap is one arena per CPU, up to HALF_FIT_CPU_ARENAS of them, each made of
+    init_size bytes of a single block from calloc and each behind a lock of its own. half_alloc takes from the arena
+    of the CPU that sched_getcpu reports, and from the others in turn only when that one is full; half_free gives a
+    block back to the arena it came from, which its address tells. A thread can move to another CPU between reading
+    the CPU number and taking the lock, or be preempted while holding it, so the locks stay, but they are rarely
+    contended and cost an uncontended atomic each. Nothing is held back from the arenas the way per-thread caches
+    hold blocks, so the heap's memory grows with the number of CPUs rather than with the number of threads.
+*/
+typedef struct half_cpu_arena {
+    half_fit_t arena;
+    pthread_mutex_t lock;
+} __attribute__((aligned(64))) half_cpu_arena_t;
+
+static half_cpu_arena_t half_cpus[HALF_FIT_CPU_ARENAS];
+static U32 half_cpu_count;              //arenas in use, 0 while the heap has no memory
+static size_t half_cpu_bytes;           //memory of each arena
+
+static void half_cpu_init(void)
+{
+    BOOL fresh = __FALSE;
+    long cpus;
+    U32 i;
+
+    if(default_heap == NULL){
+        cpus = sysconf(_SC_NPROCESSORS_CONF);
+        half_cpu_count = (cpus < 1) ? 1 : (cpus > HALF_FIT_CPU_ARENAS) ? HALF_FIT_CPU_ARENAS : (U32)cpus;
+        half_cpu_bytes = init_size;
+        default_heap = (char *) calloc(half_cpu_count, half_cpu_bytes);
+        if(default_heap == NULL){
+            half_cpu_count = 0;
+            return;
+        }
+        for(i = 0; i < half_cpu_count; ++i){
+            pthread_mutex_init(&half_cpus[i].lock, NULL);
+        }
+        fresh = __TRUE;
+    }
+    for(i = 0; i < half_cpu_count; ++i){
+        if(half_init_arena(&half_cpus[i].arena, default_heap + i * half_cpu_bytes, half_cpu_bytes) != 0){
+            memset(&half_cpus[i].arena, 0, sizeof(half_fit_t));
+        } else if(fresh){
+            half_mark_zero(half_cpus[i].arena.base_address);
+        }
+    }
+}
+
+static __inline U32 half_cpu_current(void)
+{
+    int cpu = sched_getcpu();
+
+    return (cpu < 0) ? 0 : (U32)cpu % half_cpu_count;
+}
+
+//the arena a block of the default heap came from
+static __inline half_cpu_arena_t *half_cpu_owner(char *mem_block)
+{
+    return &half_cpus[(size_t)(mem_block - default_heap) / half_cpu_bytes];
+}
+
+//allocates 'n' bytes aligned to 'alignment' (a valid one), zeroed if 'zero' is set, from the current CPU's arena, or
+//the next one with room
+static char *half_cpu_take(U32 alignment, U32 n, BOOL zero)
+{
+    char *mem_block;
+    U32 first, i;
+
+    if(half_cpu_count == 0){
+        return NULL;
+    }
+    first = i = half_cpu_current();
+    do {
+        pthread_mutex_lock(&half_cpus[i].lock);
+        mem_block = half_take_from(&half_cpus[i].arena, alignment, n, zero);
+        pthread_mutex_unlock(&half_cpus[i].lock);
+        if(mem_block != NULL){
+            return mem_block;
+        }
+        i = (i + 1 == half_cpu_count) ? 0 : i + 1;
+    } while(i != first);
+    return NULL;
+}
+
+static void half_cpu_free(char *mem_block)
+{
+    half_cpu_arena_t *cpu;
+
+    if(mem_block == NULL){
+        return;
+    }
+    cpu = half_cpu_owner(mem_block);
+    pthread_mutex_lock(&cpu->lock);
+    half_free_to(&cpu->arena, mem_block);
+    pthread_mutex_unlock(&cpu->lock);
+}
+
+static void half_cpu_free_sized(char *mem_block, U32 n)
+{
+    half_cpu_arena_t *cpu;
+
+    if(mem_block == NULL){
+        return;
+    }
+    cpu = half_cpu_owner(mem_block);
+    pthread_mutex_lock(&cpu->lock);
+    half_free_sized_to(&cpu->arena, mem_block, n);
+    pthread_mutex_unlock(&cpu->lock);
+}
+
+static char *half_cpu_realloc(char *mem_block, U32 n)
+{
+    half_cpu_arena_t *cpu;
+    char *new_block;
+    size_t old_bytes = 0;
+
+    if(mem_block == NULL){
+        return half_cpu_take(HALF_FIT_MIN_ALIGN, n, __FALSE);
+    }
+    if(n == 0){
+        half_cpu_free(mem_block);
+        return NULL;
+    }
+
+    //in place, or moved within its own arena
+    cpu = half_cpu_owner(mem_block);
+    pthread_mutex_lock(&cpu->lock);
+    new_block = half_realloc_from(&cpu->arena, mem_block, n);
+    if(new_block == NULL){
+        old_bytes = half_usable_size_from(&cpu->arena, mem_block);
+    }
+    pthread_mutex_unlock(&cpu->lock);
+    if(new_block != NULL){
+        return new_block;
+    }
+
+    new_block = half_cpu_take(HALF_FIT_MIN_ALIGN, n, __FALSE);
+    if(new_block != NULL){
+        memcpy(new_block, mem_block, (old_bytes < n) ? old_bytes : n);
+        half_cpu_free(mem_block);
+    }
+    return new_block;
+}
+
+static U32 half_cpu_alloc_batch(U32 n, U32 count, char **out)
+{
+    U32 filled = 0;
+    U32 first, i;
+
+    if(half_cpu_count == 0){
+        return 0;
+    }
+    first = i = half_cpu_current();
+    do {
+        pthread_mutex_lock(&half_cpus[i].lock);
+        filled += half_alloc_batch_from(&half_cpus[i].arena, n, count - filled, out + filled);
+        pthread_mutex_unlock(&half_cpus[i].lock);
+        i = (i + 1 == half_cpu_count) ? 0 : i + 1;
+    } while(filled < count && i != first);
+    return filled;
+}
+
+static void half_cpu_free_batch(char **ptrs, U32 count)
+{
+    half_cpu_arena_t *cpu;
+    U32 start = 0;
+    U32 i;
+
+    //runs of blocks from the same arena are freed together under one lock
+    while(start < count){
+        if(ptrs[start] == NULL){
+            start++;
+            continue;
+        }
+        cpu = half_cpu_owner(ptrs[start]);
+        for(i = start + 1; i < count && (ptrs[i] == NULL || half_cpu_owner(ptrs[i]) == cpu); ++i){
+        }
+        pthread_mutex_lock(&cpu->lock);
+        half_free_batch_to(&cpu->arena, ptrs + start, i - start);
+        pthread_mutex_unlock(&cpu->lock);
+        start = i;
+    }
+}
+
+#elif HALF_FIT_THREAD_SAFE
+/*
+    In thread safe builds the default heap is shared by every thread behind half_fit_lock, and each thread keeps a
+    cache of allocated-but-unused blocks of every size from 1 to HALF_FIT_CACHE_CLASSES units in front of it.
+    half_alloc and half_free only touch the calling thread's cache in the common case. The lock is taken once per
+    HALF_FIT_CACHE_BATCH blocks to refill an empty size, once to flush half of a size that grew past
+    HALF_FIT_CACHE_LIMIT, and once per call for blocks too big to cache. Cached blocks stay marked allocated in the
+    heap, so nothing coalesces with them until they are flushed; a thread's cache is flushed when the thread exits.
+*/
+typedef struct half_cache {
+    U32  heads[HALF_FIT_CACHE_CLASSES];     //offset of the first cached block of each size
+    U32  counts[HALF_FIT_CACHE_CLASSES];    //number of cached blocks of each size
+    U32  generation;                        //the half_init call the cached blocks belong to
+    BOOL registered;                        //the thread exit destructor knows about this cache
+} half_cache_t;
+
+//cached blocks are chained through the first word of their memory
+#define CACHE_NEXT(block_addr)  (*(U32 *)((block_addr) + HALF_FIT_HEADER_SIZE))
+
+static pthread_mutex_t half_fit_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t  half_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t   half_cache_key;
+static U32             half_generation; //bumped by every half_init, so caches can tell their blocks are gone
+static __thread half_cache_t half_cache;
+
+//gives cached blocks of one size back to the heap until only 'keep' are left; half_fit_lock must be held
+static void half_cache_release(half_cache_t *cache, U32 cls, U32 keep)
+{
+    char *block_addr;
+
+    while(cache->counts[cls] > keep){
+        block_addr = half_address_of(&half_fit, cache->heads[cls]);
+        cache->heads[cls] = CACHE_NEXT(block_addr);
+        cache->counts[cls]--;
+        half_release_block(&half_fit, block_addr);
+    }
+}
+
+//gives every cached block back to the heap; half_fit_lock must be held. Returns __FALSE if there was nothing to give
+static BOOL half_cache_release_all(half_cache_t *cache)
+{
+    BOOL released = __FALSE;
+    U32 cls;
+
+    for(cls = 0; cls < HALF_FIT_CACHE_CLASSES; ++cls){
+        if(cache->counts[cls] != 0){
+            half_cache_release(cache, cls, 0);
+            released = __TRUE;
+        }
+    }
+    return released;
+}
+
+//takes a block from the shared heap, giving the calling thread's cache back first if the heap is too fragmented
+//half_fit_lock must be held
+static char *half_take_shared(half_cache_t *cache, U32 units, BOOL *zeroed)
+{
+    char *mem_block = half_take_block(&half_fit, units, zeroed);
+
+    if(mem_block == NULL && half_cache_release_all(cache)){
+        mem_block = half_take_block(&half_fit, units, zeroed);
+    }
+    return mem_block;
+}
+
+static void half_cache_exit(void *arg)
+{
+    half_cache_t *cache = (half_cache_t *)arg;
+
+    if(cache->generation == __atomic_load_n(&half_generation, __ATOMIC_ACQUIRE)){
+        pthread_mutex_lock(&half_fit_lock);
+        half_cache_release_all(cache);
+        pthread_mutex_unlock(&half_fit_lock);
+    }
+}
+
+static void half_cache_make_key(void)
+{
+    pthread_key_create(&half_cache_key, half_cache_exit);
+}
+
+static half_cache_t *half_cache_get(void)
+{
+    half_cache_t *cache = &half_cache;
+    U32 generation = __atomic_load_n(&half_generation, __ATOMIC_ACQUIRE);
+    U32 cls;
+
+    if(cache->generation != generation){
+        //first use in this thread, or the heap was re-initialised and the cached blocks no longer exist
+        for(cls = 0; cls < HALF_FIT_CACHE_CLASSES; ++cls){
+            cache->counts[cls] = 0;
+        }
+        cache->generation = generation;
+
+        if(!cache->registered){
+            pthread_once(&half_cache_once, half_cache_make_key);
+            pthread_setspecific(half_cache_key, cache);
+            cache->registered = __TRUE;
+        }
+    }
+    return cache;
+}
+
+//half_alloc and half_free of thread safe builds; 'zeroed' as for half_take_block
+static char *half_cache_alloc(U32 n, BOOL *zeroed)
+{
+    U32 units = half_units_for(n);
+    U32 cls = units - 1;
+    half_cache_t *cache;
+    char *mem_block;
+    U32 count, i;
+
+    cache = half_cache_get();
+    if(units > HALF_FIT_CACHE_CLASSES){
+        pthread_mutex_lock(&half_fit_lock);
+        mem_block = half_take_shared(cache, units, zeroed);
+        if(mem_block == NULL){
+            HF_STAT(half_fit.failed_allocs++);
+        }
+        pthread_mutex_unlock(&half_fit_lock);
+        return (mem_block == NULL) ? NULL : mem_block + HALF_FIT_HEADER_SIZE;
+    }
+
+    if(cache->counts[cls] == 0){
+        //refill a whole batch with one trip to the shared heap
+        pthread_mutex_lock(&half_fit_lock);
+        count = HALF_FIT_CACHE_BATCH;
+        mem_block = half_take_run(&half_fit, units, &count);
+        if(mem_block == NULL && half_cache_release_all(cache)){
+            count = HALF_FIT_CACHE_BATCH;
+            mem_block = half_take_run(&half_fit, units, &count);
+        }
+        if(mem_block == NULL){
+            HF_STAT(half_fit.failed_allocs++);
+        }
+        pthread_mutex_unlock(&half_fit_lock);
+
+        if(mem_block == NULL){
+            return NULL;
+        }
+        //the run's blocks are adjacent, so the cache list is threaded through them in address order
+        for(i = count; i-- != 0; ){
+            CACHE_NEXT(mem_block + (size_t)i * units * 32) = cache->heads[cls];
+            cache->heads[cls] = half_offset_of(&half_fit, mem_block) + i * units;
+        }
+        cache->counts[cls] = count;
+    }
+
+    mem_block = half_address_of(&half_fit, cache->heads[cls]);
+    cache->heads[cls] = CACHE_NEXT(mem_block);
+    cache->counts[cls]--;
+    if(zeroed != NULL){
+        *zeroed = __FALSE;
+    }
+    return mem_block + HALF_FIT_HEADER_SIZE;
+}
+
+static void half_cache_free(char *mem_block)
+{
+    char *block_addr;
+    half_cache_t *cache;
+    U32 cls;
+
+    if(mem_block == NULL){
+        return;
+    }
+    block_addr = half_block_of(mem_block);
+
+    //neighbours may rewrite the prev field of this header under the lock, but only the owner of an allocated block
+    //ever changes its size, so the size read here is stable
+    cls = half_owner_size(block_addr) - 1;
+    if(cls >= HALF_FIT_CACHE_CLASSES){
+        pthread_mutex_lock(&half_fit_lock);
+        half_release_block(&half_fit, block_addr);
+        pthread_mutex_unlock(&half_fit_lock);
+        return;
+    }
+
+    cache = half_cache_get();
+    CACHE_NEXT(block_addr) = cache->heads[cls];
+    cache->heads[cls] = half_offset_of(&half_fit, block_addr);
+    if(++cache->counts[cls] > HALF_FIT_CACHE_LIMIT){
+        pthread_mutex_lock(&half_fit_lock);
+        half_cache_release(cache, cls, HALF_FIT_CACHE_LIMIT / 2);
+        pthread_mutex_unlock(&half_fit_lock);
+    }
+}
+#endif
+
+#if HALF_FIT_GROW
+#if HALF_FIT_THREAD_SAFE
+#error "HALF_FIT_GROW cannot be combined with HALF_FIT_THREAD_SAFE"
+#endif
+#if (HALF_FIT_CHUNK_SIZE & (HALF_FIT_CHUNK_SIZE - 1)) != 0 || HALF_FIT_CHUNK_SIZE < 8192
+#error "HALF_FIT_CHUNK_SIZE must be a power of two of at least 8 KiB"
+#endif
+/*
+    Growth. When the heap from half_init cannot serve a request, the default heap tries its chunks and then maps a
+    new one: HALF_FIT_CHUNK_SIZE bytes on a HALF_FIT_CHUNK_SIZE boundary, starting with a half_chunk_t whose arena
+    manages the rest. Blocks only ever coalesce within their own chunk. A request that no chunk could hold gets a
+    direct mapping laid out the same way, with an arena of size 0 and the memory inside the first HALF_FIT_CHUNK_SIZE
+    bytes, so masking the address of any block outside the initial heap finds its chunk or mapping in O(1).
+    Direct mappings are unmapped as soon as they are freed. A chunk that becomes empty stays mapped, ready for the
+    next burst, until the empty chunks add up to more than the trim threshold.
+*/
+typedef struct half_chunk {
+    half_fit_t arena;                   //size 0 for a direct mapping
+    size_t map_bytes;                   //length of the mapping
+    struct half_chunk *prev;
+    struct half_chunk *next;
+    BOOL empty;                         //counted in half_empty_chunks
+} half_chunk_t;
+
+#define CHUNK_HEADER_BYTES  ((sizeof(half_chunk_t) + 63) & ~(size_t)63)
+#define CHUNK_OF(mem_block) ((half_chunk_t *)((size_t)(mem_block) & ~(size_t)(HALF_FIT_CHUNK_SIZE - 1)))
+
+static half_chunk_t *half_chunks;      //chunks, the one that last served an allocation first
+static half_chunk_t *half_direct;      //direct mappings
+static U32 half_empty_chunks;
+static size_t half_trim_threshold = HALF_FIT_TRIM_THRESHOLD;
+
+static void half_chunk_link(half_chunk_t **list, half_chunk_t *chunk)
+{
+    chunk->prev = NULL;
+    chunk->next = *list;
+    if(*list != NULL){
+        (*list)->prev = chunk;
+    }
+    *list = chunk;
+}
+
+static void half_chunk_unlink(half_chunk_t **list, half_chunk_t *chunk)
+{
+    if(chunk->prev != NULL){
+        chunk->prev->next = chunk->next;
+    } else {
+        *list = chunk->next;
+    }
+    if(chunk->next != NULL){
+        chunk->next->prev = chunk->prev;
+    }
+}
+
+//maps 'len' bytes (a multiple of the page size) starting on a HALF_FIT_CHUNK_SIZE boundary; a mapping shorter than
+//a chunk still has the rest of its chunk to itself, as nothing else starts off a chunk boundary
+static half_chunk_t *half_map_chunk(size_t len)
+{
+    size_t span = len + HALF_FIT_CHUNK_SIZE;
+    char *map, *start;
+
+    if(len == 0 || span < len){
+        return NULL;
+    }
+    map = (char *)mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED){
+        return NULL;
+    }
+    start = (char *)(((size_t)map + HALF_FIT_CHUNK_SIZE - 1) & ~(size_t)(HALF_FIT_CHUNK_SIZE - 1));
+    if(start != map){
+        munmap(map, (size_t)(start - map));
+    }
+    if(start + len != map + span){
+        munmap(start + len, (size_t)(map + span - start - len));
+    }
+    ((half_chunk_t *)start)->map_bytes = len; //the rest of the header is zero, as mapped
+    return (half_chunk_t *)start;
+}
+
+//units of the largest block a chunk can hold
+static __inline U32 half_chunk_units(void)
+{
+    size_t units = (HALF_FIT_CHUNK_SIZE - CHUNK_HEADER_BYTES) >> 5;
+
+    return (units >= HALF_FIT_MAX_UNITS) ? HALF_FIT_MAX_UNITS : (U32)units;
+}
+
+//the arena a block of the default heap belongs to, NULL for a direct mapping
+static half_fit_t *half_grow_owner(char *mem_block)
+{
+    half_chunk_t *chunk;
+
+    if((size_t)mem_block - (size_t)half_fit.base_address < ((size_t)half_fit.size << 5)){
+        return &half_fit;
+    }
+    chunk = CHUNK_OF(mem_block);
+    return (chunk->arena.size == 0) ? NULL : &chunk->arena;
+}
+
+//unmaps empty chunks until at most 'keep' are left; returns the bytes unmapped
+static size_t half_unmap_empty(U32 keep)
+{
+    half_chunk_t *chunk = half_chunks;
+    half_chunk_t *next;
+    size_t released = 0;
+
+    while(chunk != NULL && half_empty_chunks > keep){
+        next = chunk->next;
+        if(chunk->empty){
+            half_chunk_unlink(&half_chunks, chunk);
+            half_empty_chunks--;
+            released += chunk->map_bytes;
+            munmap(chunk, chunk->map_bytes);
+        }
+        chunk = next;
+    }
+    return released;
+}
+
+//a chunk served an allocation: it moves to the front of the list and is no longer empty
+static void half_chunk_used(half_chunk_t *chunk)
+{
+    if(chunk->empty){
+        chunk->empty = __FALSE;
+        half_empty_chunks--;
+    }
+    if(chunk != half_chunks){
+        half_chunk_unlink(&half_chunks, chunk);
+        half_chunk_link(&half_chunks, chunk);
+    }
+}
+
+//a block went back to a chunk, which may have become empty
+static void half_chunk_released(half_chunk_t *chunk)
+{
+    if(chunk->empty || half_free_bytes(&chunk->arena) != (size_t)chunk->arena.size << 5){
+        return;
+    }
+    chunk->empty = __TRUE;
+    half_empty_chunks++;
+    if((size_t)half_empty_chunks * HALF_FIT_CHUNK_SIZE > half_trim_threshold){
+        half_unmap_empty((U32)(half_trim_threshold / HALF_FIT_CHUNK_SIZE));
+    }
+}
+
+static char *half_direct_alloc(U32 alignment, U32 n)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t lead = (CHUNK_HEADER_BYTES + alignment - 1) & ~(size_t)(alignment - 1);
+    half_chunk_t *chunk = half_map_chunk((lead + n + page - 1) & ~(page - 1));
+
+    if(chunk == NULL){
+        return NULL;
+    }
+    half_chunk_link(&half_direct, chunk);
+    return (char *)chunk + lead;
+}
+
+//allocates 'n' bytes aligned to 'alignment' (at least HALF_FIT_MIN_ALIGN), zeroed if 'zero' is set, from wherever
+//there is room. Chunks and direct mappings come zeroed from the OS
+static char *half_grow_take(U32 alignment, U32 n, BOOL zero)
+{
+    half_chunk_t *chunk;
+    char *mem_block;
+
+    mem_block = half_take_from(&half_fit, alignment, n, zero);
+    if(mem_block != NULL){
+        return mem_block;
+    }
+    for(chunk = half_chunks; chunk != NULL; chunk = chunk->next){
+        mem_block = half_take_from(&chunk->arena, alignment, n, zero);
+        if(mem_block != NULL){
+            half_chunk_used(chunk);
+            return mem_block;
+        }
+    }
+
+    if(n > ~0u - alignment || half_units_for(n + alignment - HALF_FIT_MIN_ALIGN) > half_chunk_units()){
+        return half_direct_alloc(alignment, n);
+    }
+    chunk = half_map_chunk(HALF_FIT_CHUNK_SIZE);
+    if(chunk == NULL){
+        return NULL;
+    }
+    half_init_arena(&chunk->arena, (char *)chunk + CHUNK_HEADER_BYTES, HALF_FIT_CHUNK_SIZE - CHUNK_HEADER_BYTES);
+    half_mark_zero(chunk->arena.base_address);
+    half_chunk_link(&half_chunks, chunk);
+    return half_take_from(&chunk->arena, alignment, n, zero);
+}
+
+static void half_grow_free(char *mem_block)
+{
+    half_fit_t *hf;
+    half_chunk_t *chunk;
+
+    if(mem_block == NULL){
+        return;
+    }
+    hf = half_grow_owner(mem_block);
+    chunk = CHUNK_OF(mem_block);
+    if(hf == NULL){
+        half_chunk_unlink(&half_direct, chunk);
+        munmap(chunk, chunk->map_bytes);
+    } else {
+        half_free_to(hf, mem_block);
+        if(hf != &half_fit){
+            half_chunk_released(chunk);
+        }
+    }
+}
+
+static char *half_grow_realloc(char *mem_block, U32 n)
+{
+    half_fit_t *hf;
+    char *new_block;
+    size_t old_bytes;
+
+    if(mem_block == NULL){
+        return half_grow_take(HALF_FIT_MIN_ALIGN, n, __FALSE);
+    }
+    if(n == 0){
+        half_grow_free(mem_block);
+        return NULL;
+    }
+
+    hf = half_grow_owner(mem_block);
+    if(hf == NULL){
+        old_bytes = CHUNK_OF(mem_block)->map_bytes - (size_t)(mem_block - (char *)CHUNK_OF(mem_block));
+        if(n <= old_bytes){
+            return mem_block;
+        }
+    } else {
+        //in place, or moved within its own arena
+        new_block = half_realloc_from(hf, mem_block, n);
+        if(new_block != NULL){
+            return new_block;
+        }
+        old_bytes = half_usable_size_from(hf, mem_block);
+    }
+
+    new_block = half_grow_take(HALF_FIT_MIN_ALIGN, n, __FALSE);
+    if(new_block != NULL){
+        memcpy(new_block, mem_block, (old_bytes < n) ? old_bytes : n);
+        half_grow_free(mem_block);
+    }
+    return new_block;
+}
+
+static U32 half_grow_alloc_batch(U32 n, U32 count, char **out)
+{
+    U32 filled = half_alloc_batch_from(&half_fit, n, count, out);
+    half_chunk_t *chunk;
+    U32 got;
+
+    for(chunk = half_chunks; chunk != NULL && filled < count; chunk = chunk->next){
+        got = half_alloc_batch_from(&chunk->arena, n, count - filled, out + filled);
+        if(got != 0){
+            half_chunk_used(chunk);
+            filled += got;
+        }
+    }
+    //new chunks are filled a whole batch at a time too: the first block maps one, the rest follow it
+    while(filled < count && (out[filled] = half_grow_take(HALF_FIT_MIN_ALIGN, n, __FALSE)) != NULL){
+        filled++;
+        if(half_grow_owner(out[filled - 1]) == &half_chunks->arena){
+            filled += half_alloc_batch_from(&half_chunks->arena, n, count - filled, out + filled);
+        }
+    }
+    return filled;
+}
+
+static void half_grow_free_batch(char **ptrs, U32 count)
+{
+    half_fit_t *hf;
+    U32 start = 0;
+    U32 i;
+
+    //runs of blocks from the same arena are freed together; direct mappings one by one
+    while(start < count){
+        if(ptrs[start] == NULL){
+            start++;
+            continue;
+        }
+        hf = half_grow_owner(ptrs[start]);
+        if(hf == NULL){
+            half_grow_free(ptrs[start++]);
+            continue;
+        }
+        for(i = start + 1; i < count && (ptrs[i] == NULL || half_grow_owner(ptrs[i]) == hf); ++i){
+        }
+        half_free_batch_to(hf, ptrs + start, i - start);
+        if(hf != &half_fit){
+            half_chunk_released(CHUNK_OF(ptrs[start]));
+        }
+        start = i;
+    }
+}
+
+//gives the pages inside the free blocks of an arena back to the OS; returns the bytes given back
+static size_t half_trim_arena(half_fit_t *hf, size_t page)
+{
+    size_t released = 0;
+    U32 bin, offset, next_in_bin;
+    char *block_addr, *start, *end;
+
+    half_reclaim(hf);
+    for(bin = 0; bin < hf->bins << SUB_BIN_BITS; ++bin){
+        if(!half_bin_used(hf, bin) || ((size_t)2 << (bin >> SUB_BIN_BITS)) * 32 <= page){
+            continue; //blocks of this bin are all smaller than two pages
+        }
+        offset = hf->bin_heads[bin];
+        for(;;){
+            block_addr = half_address_of(hf, offset);
+            //the header and the bin links stay
+            start = (char *)(((size_t)block_addr + HALF_FIT_HEADER_SIZE + sizeof(half_links_t) + page - 1) & ~(page - 1));
+            end = (char *)(((size_t)block_addr + ((size_t)half_size_of(HEADER(block_addr)) << 5)) & ~(page - 1));
+            if(end > start && madvise(start, (size_t)(end - start), MADV_DONTNEED) == 0){
+                released += (size_t)(end - start);
+            }
+            next_in_bin = half_next_in_bin(block_addr);
+            if(next_in_bin == offset){
+                break;
+            }
+            offset = next_in_bin;
+        }
+    }
+    return released;
+}
+
+size_t half_trim( void)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t released;
+    half_chunk_t *chunk;
+
+    //an empty slab is all that keeps some chunks from being empty
+    for(chunk = half_chunks; chunk != NULL; chunk = chunk->next){
+        half_reclaim(&chunk->arena);
+        half_chunk_released(chunk);
+    }
+    released = half_unmap_empty(0);
+    for(chunk = half_chunks; chunk != NULL; chunk = chunk->next){
+        released += half_trim_arena(&chunk->arena, page);
+    }
+    return released + half_trim_arena(&half_fit, page);
+}
+
+void half_set_trim_threshold( size_t bytes)
+{
+    half_trim_threshold = bytes;
+    if((size_t)half_empty_chunks * HALF_FIT_CHUNK_SIZE > half_trim_threshold){
+        half_unmap_empty((U32)(half_trim_threshold / HALF_FIT_CHUNK_SIZE));
+    }
+}
+
+//forgets every chunk and direct mapping
+static void half_grow_reset(void)
+{
+    half_chunk_t *chunk;
+
+    while((chunk = half_chunks) != NULL){
+        half_chunks = chunk->next;
+        munmap(chunk, chunk->map_bytes);
+    }
+    while((chunk = half_direct) != NULL){
+        half_direct = chunk->next;
+        munmap(chunk, chunk->map_bytes);
+    }
+    half_empty_chunks = 0;
+}
+#endif
+
+//the default heap: init_size bytes from calloc behind half_init/half_alloc/half_free. calloc usually gets big blocks
+//straight from the OS without writing them, and the first time round half_calloc can then skip clearing them
+void  half_init( void )
+{
+#if HALF_FIT_PER_CPU
+    half_cpu_init();
+#else
+    BOOL fresh = __FALSE;
+
+#if HALF_FIT_THREAD_SAFE
+    pthread_mutex_lock(&half_fit_lock);
+#endif
+#if HALF_FIT_GROW
+    half_grow_reset();
+#endif
+    if(default_heap == NULL){
+        default_heap = (char *) calloc(1, init_size);
+        fresh = __TRUE;
+    }
+
+    //the whole heap is one free block in bin 10, the block size 32768 (32*1024); without memory (or with too little
+    //for a single block) it is an arena of size 0, which fails every request without ever touching the memory
+    if(default_heap == NULL || half_init_arena(&half_fit, default_heap, init_size) != 0){
+        memset(&half_fit, 0, sizeof(half_fit));
+    } else if(fresh){
+        half_mark_zero(half_fit.base_address);
+    }
+#if HALF_FIT_THREAD_SAFE
+    __atomic_store_n(&half_generation, half_generation + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&half_fit_lock);
+#endif
+#endif
+}
+
+
+
+static char *half_heap_alloc(U32 n)
+{
+#if HALF_FIT_PER_CPU
+    return half_cpu_take(HALF_FIT_MIN_ALIGN, n, __FALSE);
+#elif HALF_FIT_THREAD_SAFE
+    return half_cache_alloc(n, NULL);
+#elif HALF_FIT_GROW
+    return half_grow_take(HALF_FIT_MIN_ALIGN, n, __FALSE);
+#else
+    return half_alloc_from(&half_fit, n);
+#endif
+}
+
+static char *half_heap_calloc(U32 n)
+{
+#if HALF_FIT_PER_CPU
+    return half_cpu_take(HALF_FIT_MIN_ALIGN, n, __TRUE);
+#elif HALF_FIT_THREAD_SAFE
+    BOOL zeroed = __FALSE;
+    char *mem_block = half_cache_alloc(n, &zeroed);
+
+    if(mem_block != NULL){
+        half_clear_taken(mem_block, n, zeroed);
+    }
+    return mem_block;
+#elif HALF_FIT_GROW
+    return half_grow_take(HALF_FIT_MIN_ALIGN, n, __TRUE);
+#else
+    return half_calloc_from(&half_fit, 1, n);
+#endif
+}
+
+static void half_heap_free(char *mem_block)
+{
+#if HALF_FIT_PER_CPU
+    half_cpu_free(mem_block);
+#elif HALF_FIT_THREAD_SAFE
+    half_cache_free(mem_block);
+#elif HALF_FIT_GROW
+    half_grow_free(mem_block);
+#else
+    half_free_to(&half_fit, mem_block);
+#endif
+}
+
+static void half_heap_free_sized(char *mem_block, U32 n)
+{
+#if HALF_FIT_PER_CPU
+    half_cpu_free_sized(mem_block, n);
+#elif HALF_FIT_THREAD_SAFE || HALF_FIT_GROW
+    (void)n;
+    half_heap_free(mem_block); //the cache or chunk lookup needs the header anyway
+#else
+    half_free_sized_to(&half_fit, mem_block, n);
+#endif
+}
+
+static U32 half_heap_alloc_batch(U32 n, U32 count, char **out)
+{
+#if HALF_FIT_PER_CPU
+    return half_cpu_alloc_batch(n, count, out);
+#elif HALF_FIT_THREAD_SAFE
+    //a batch bypasses the thread's cache and goes to the shared heap with one lock
+    half_cache_t *cache = half_cache_get();
+    U32 units = half_units_for(n);
+    U32 filled;
+
+    pthread_mutex_lock(&half_fit_lock);
+    filled = half_take_batch(&half_fit, units, count, out);
+    if(filled < count && half_cache_release_all(cache)){
+        filled += half_take_batch(&half_fit, units, count - filled, out + filled);
+    }
+    if(filled < count){
+        HF_STAT(half_fit.failed_allocs++);
+    }
+    pthread_mutex_unlock(&half_fit_lock);
+    return filled;
+#elif HALF_FIT_GROW
+    return half_grow_alloc_batch(n, count, out);
+#else
+    return half_alloc_batch_from(&half_fit, n, count, out);
+#endif
+}
+
+static void half_heap_free_batch(char **ptrs, U32 count)
+{
+#if HALF_FIT_PER_CPU
+    half_cpu_free_batch(ptrs, count);
+#elif HALF_FIT_THREAD_SAFE
+    pthread_mutex_lock(&half_fit_lock);
+    half_release_batch(&half_fit, ptrs, count);
+    pthread_mutex_unlock(&half_fit_lock);
+#elif HALF_FIT_GROW
+    half_grow_free_batch(ptrs, count);
+#else
+    half_free_batch_to(&half_fit, ptrs, count);
+#endif
+}
+
+static char *half_heap_realloc(char *mem_block, U32 n)
+{
+#if HALF_FIT_PER_CPU
+    return half_cpu_realloc(mem_block, n);
+#elif HALF_FIT_THREAD_SAFE
+    char *new_block, *block_addr;
+    U32 old_bytes, lead;
+    BOOL resized = __FALSE;
+
+    if(mem_block == NULL){
+        return half_cache_alloc(n, NULL);
+    }
+    if(n == 0){
+        half_cache_free(mem_block);
+        return NULL;
+    }
+
+    block_addr = half_block_of(mem_block);
+    lead = (U32)(mem_block - block_addr) - HALF_FIT_HEADER_SIZE;
+    if(n <= ~0u - lead){
+        pthread_mutex_lock(&half_fit_lock);
+        resized = half_resize_block(&half_fit, block_addr, half_units_for(n + lead));
+        pthread_mutex_unlock(&half_fit_lock);
+    }
+    if(resized){
+        return mem_block;
+    }
+
+    old_bytes = (half_owner_size(block_addr) << 5) - HALF_FIT_HEADER_SIZE - lead;
+    new_block = half_cache_alloc(n, NULL);
+    if(new_block != NULL){
+        memcpy(new_block, mem_block, (old_bytes < n) ? old_bytes : n);
+        half_cache_free(mem_block);
+    }
+    return new_block;
+#elif HALF_FIT_GROW
+    return half_grow_realloc(mem_block, n);
+#else
+    return half_realloc_from(&half_fit, mem_block, n);
+#endif
+}
+
+static char *half_heap_aligned_alloc(U32 alignment, U32 n)
+{
+#if HALF_FIT_PER_CPU
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > HALF_FIT_MAX_ALIGN){
+        return NULL;
+    }
+    return half_cpu_take(alignment, n, __FALSE);
+#elif HALF_FIT_THREAD_SAFE
+    //aligned blocks are not cached; they come straight from the shared heap
+    half_cache_t *cache;
+    char *mem_block;
+
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment > HALF_FIT_MAX_ALIGN){
+        return NULL;
+    }
+    if(alignment <= HALF_FIT_MIN_ALIGN){
+        return half_cache_alloc(n, NULL);
+    }
+
+    cache = half_cache_get();
+    pthread_mutex_lock(&half_fit_lock);
+    mem_block = half_take_aligned_memory(&half_fit, alignment, n);
+    if(mem_block == NULL && half_cache_release_all(cache)){
+        mem_block = half_take_aligned_memory(&half_fit, alignment, n);
+    }
+    if(mem_block == NULL){
+        HF_STAT(half_fit.failed_allocs++);
+    }
+    pthread_mutex_unlock(&half_fit_lock);
+    return mem_block;
+#elif HALF_FIT_GROW
+    if(alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment >= HALF_FIT_CHUNK_SIZE){
+        return NULL;
+    }
+    if(alignment > HALF_FIT_MAX_ALIGN){
+        return half_direct_alloc(alignment, n); //the memory still starts inside the mapping's first chunk
+    }
+    return half_grow_take((alignment < HALF_FIT_MIN_ALIGN) ? HALF_FIT_MIN_ALIGN : alignment, n, __FALSE);
+#else
+    return half_aligned_alloc_from(&half_fit, alignment, n);
+#endif
+}
+
+#if HALF_FIT_TRACE
+/*
+    Tracing. While a trace is running every call to the default heap's functions appends a half_trace_record_t to
+    a buffer of HALF_FIT_TRACE_BUFFER records, which is written to the trace file whenever it fills up. Frees are
+    recorded before the memory is given back and allocations after it was taken, so an address never shows up
+    allocated twice; in thread safe builds the calls themselves are serialised while tracing is compiled in, so
+    that the file holds them in the order they took effect.
+*/
+static FILE *half_trace_file;
+static half_trace_record_t half_trace_buffer[HALF_FIT_TRACE_BUFFER];
+static U32 half_trace_used;
+static struct timespec half_trace_epoch;
+#if HALF_FIT_THREAD_SAFE
+static pthread_mutex_t half_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#define HF_TRACE_ENTER()    pthread_mutex_lock(&half_trace_lock)
+#define HF_TRACE_LEAVE()    pthread_mutex_unlock(&half_trace_lock)
+#else
+#define HF_TRACE_ENTER()    ((void)0)
+#define HF_TRACE_LEAVE()    ((void)0)
+#endif
+
+static void half_trace_flush(void)
+{
+    if(half_trace_used != 0){
+        fwrite(half_trace_buffer, sizeof(half_trace_record_t), half_trace_used, half_trace_file);
+        half_trace_used = 0;
+    }
+}
+
+static void half_trace(U32 op, U32 size, char *mem_block)
+{
+    half_trace_record_t *record;
+    struct timespec now;
+
+    if(half_trace_file == NULL){
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    record = &half_trace_buffer[half_trace_used];
+    record->time = (unsigned long long)(now.tv_sec - half_trace_epoch.tv_sec) * 1000000000u
+                 + (unsigned long long)now.tv_nsec - (unsigned long long)half_trace_epoch.tv_nsec;
+    record->id = (unsigned long long)(size_t)mem_block;
+    record->size = size;
+    record->op = op;
+    if(++half_trace_used == HALF_FIT_TRACE_BUFFER){
+        half_trace_flush();
+    }
+}
+
+int half_trace_start(const char *path)
+{
+    static BOOL registered;
+    half_trace_header_t header;
+    int result = 0;
+
+    HF_TRACE_ENTER();
+    if(half_trace_file != NULL){
+        half_trace_flush();
+        fclose(half_trace_file);
+    }
+    half_trace_file = fopen(path, "wb");
+    if(half_trace_file == NULL){
+        result = -1;
+    } else {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HALF_TRACE_MAGIC, sizeof(header.magic));
+        header.record_size = sizeof(half_trace_record_t);
+        fwrite(&header, sizeof(header), 1, half_trace_file);
+        half_trace_used = 0;
+        clock_gettime(CLOCK_MONOTONIC, &half_trace_epoch);
+        if(!registered){
+            atexit(half_trace_stop); //so that a process that never stops its trace still flushes it
+            registered = __TRUE;
+        }
+    }
+    HF_TRACE_LEAVE();
+    return result;
+}
+
+void half_trace_stop(void)
+{
+    HF_TRACE_ENTER();
+    if(half_trace_file != NULL){
+        half_trace_flush();
+        fclose(half_trace_file);
+        half_trace_file = NULL;
+    }
+    HF_TRACE_LEAVE();
+}
+#define HF_TRACE(op, size, mem_block)   half_trace((op), (size), (mem_block))
+#else
+#define HF_TRACE_ENTER()                ((void)0)
+#define HF_TRACE_LEAVE()                ((void)0)
+#define HF_TRACE(op, size, mem_block)   ((void)0)
+#endif
+
+#if HALF_FIT_PROFILE
+#if (HALF_FIT_PROFILE_SLOTS & (HALF_FIT_PROFILE_SLOTS - 1)) != 0 || HALF_FIT_PROFILE_SLOTS > 65535
+#error "HALF_FIT_PROFILE_SLOTS must be a power of two below 65536"
+#endif
+/*
+    Heap profiling. Every thread counts down the bytes it allocates to its next sample; the allocation that gets the
+    count to zero is sampled, and the next count is drawn at random. That is all an allocation costs unless it is
+    sampled. A sample records the block's call stack in half_samples, an open addressing table keyed by the block's
+    address, taken under a lock. Frees must find their sample before the block can be handed out again, but almost
+    none have one: half_sample_marks counts the samples whose search starts at each slot, and is read without the
+    lock, since the sample of a block was marked before the block reached anyone who could free it. A free whose slot
+    has no mark is done after that one load, and so is every free while there are no samples at all.
+*/
+typedef struct half_sample {
+    char *mem_block;                    //NULL for an empty slot
+    size_t bytes;                       //bytes asked for
+    U32 depth;
+    void *stack[HALF_FIT_PROFILE_DEPTH];
+} half_sample_t;
+
+typedef struct half_sampler {
+    size_t until;                       //bytes still to be allocated before the next sample
+    unsigned long long random;          //xorshift state
+    U32 generation;                     //half_profile_generation the countdown belongs to
+} half_sampler_t;
+
+static half_sample_t half_samples[HALF_FIT_PROFILE_SLOTS];
+static unsigned short half_sample_marks[HALF_FIT_PROFILE_SLOTS];
+static U32 half_sample_count;           //samples in the table
+static size_t half_profile_rate;        //0 while no profile runs
+static size_t half_profile_taken_at;    //the rate of the last profile started, which a dump scales by
+static U32 half_profile_generation;     //bumped by every half_profile_start
+#if HALF_FIT_THREAD_SAFE
+static __thread half_sampler_t half_sampler;
+static pthread_mutex_t half_profile_lock = PTHREAD_MUTEX_INITIALIZER;
+#define HF_PROFILE_ENTER()  pthread_mutex_lock(&half_profile_lock)
+#define HF_PROFILE_LEAVE()  pthread_mutex_unlock(&half_profile_lock)
+#else
+static half_sampler_t half_sampler;
+#define HF_PROFILE_ENTER()  ((void)0)
+#define HF_PROFILE_LEAVE()  ((void)0)
+#endif
+
+//natural logarithm of x > 0, and e^-x for x >= 0, to about 1e-9 without needing libm
+static double half_ln(double x)
+{
+    double t, t2;
+    int e = 0;
+
+    while(x >= 2.0){
+        x *= 0.5;
+        ++e;
+    }
+    while(x < 1.0){
+        x *= 2.0;
+        --e;
+    }
+    t = (x - 1.0) / (x + 1.0);
+    t2 = t * t;
+    return 2.0 * t * (1.0 + t2 * (1.0 / 3 + t2 * (1.0 / 5 + t2 * (1.0 / 7 + t2 * (1.0 / 9 + t2 / 11)))))
+         + e * 0.69314718055994531;
+}
+
+static double half_exp_neg(double x)
+{
+    double sum = 1.0, term = 1.0;
+    int halvings = 0, i;
+
+    if(x > 700.0){
+        return 0.0;
+    }
+    while(x > 0.5){
+        x *= 0.5;
+        ++halvings;
+    }
+    for(i = 1; i < 14; ++i){
+        term *= -x / i;
+        sum += term;
+    }
+    while(halvings-- != 0){
+        sum *= sum;
+    }
+    return sum;
+}
+
+//bytes to the next sample: exponentially distributed with a mean of half_profile_rate, and at least 1
+static size_t half_profile_draw(half_sampler_t *sampler, size_t rate)
+{
+    unsigned long long x = sampler->random;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sampler->random = x;
+    return 1 + (size_t)(-half_ln((double)((x >> 11) + 1) * (1.0 / 9007199254740992.0)) * (double)rate);
+}
+
+static __inline U32 half_sample_slot(char *mem_block)
+{
+    return (U32)(((unsigned long long)(size_t)mem_block * 0x9E3779B97F4A7C15ull) >> 32) & (HALF_FIT_PROFILE_SLOTS - 1);
+}
+
+//records the stack of a sampled block; the two innermost frames are this function and the heap function called
+__attribute__((noinline)) static void half_profile_take(char *mem_block, size_t bytes)
+{
+    void *frames[HALF_FIT_PROFILE_DEPTH + 2];
+    int depth = backtrace(frames, HALF_FIT_PROFILE_DEPTH + 2);
+    U32 home = half_sample_slot(mem_block);
+    U32 slot = home;
+    half_sample_t *sample;
+
+    HF_PROFILE_ENTER();
+    if(half_sample_count < HALF_FIT_PROFILE_SLOTS){
+        while(half_samples[slot].mem_block != NULL){
+            slot = (slot + 1) & (HALF_FIT_PROFILE_SLOTS - 1);
+        }
+        sample = &half_samples[slot];
+        sample->mem_block = mem_block;
+        sample->bytes = bytes;
+        sample->depth = (depth > 2) ? (U32)depth - 2 : 0;
+        memcpy(sample->stack, frames + 2, sample->depth * sizeof(void *));
+        HF_STORE_RELAXED(&half_sample_count, half_sample_count + 1);
+        HF_STORE_RELAXED(&half_sample_marks[home], (unsigned short)(half_sample_marks[home] + 1));
+    }
+    HF_PROFILE_LEAVE();
+}
+
+//counts an allocation of 'bytes' towards the next sample; inlined always, so the frames half_profile_take skips
+//are its own and the public function's
+static __inline __attribute__((always_inline)) void half_profile_alloc(char *mem_block, size_t bytes)
+{
+    half_sampler_t *sampler = &half_sampler;
+    size_t rate = HF_LOAD_RELAXED(&half_profile_rate);
+    U32 generation;
+
+    if(rate == 0 || mem_block == NULL){
+        return;
+    }
+    generation = HF_LOAD_RELAXED(&half_profile_generation);
+    if(sampler->generation != generation){
+        //first allocation of this thread in this profile
+        sampler->generation = generation;
+        sampler->random = (unsigned long long)(size_t)sampler ^ ((unsigned long long)generation << 32) ^ 0x2545F4914F6CDD1Dull;
+        sampler->until = half_profile_draw(sampler, rate);
+    }
+    if(bytes < sampler->until){
+        sampler->until -= bytes;
+        return;
+    }
+    sampler->until = half_profile_draw(sampler, rate);
+    half_profile_take(mem_block, bytes);
+}
+
+//drops the sample of a block about to be freed, if it has one
+static __inline void half_profile_free(char *mem_block)
+{
+    U32 home, slot, next, want;
+
+    if(mem_block == NULL || HF_LOAD_RELAXED(&half_sample_count) == 0){
+        return;
+    }
+    home = half_sample_slot(mem_block);
+    if(HF_LOAD_RELAXED(&half_sample_marks[home]) == 0){
+        return;
+    }
+
+    HF_PROFILE_ENTER();
+    for(slot = home; half_samples[slot].mem_block != NULL; slot = (slot + 1) & (HALF_FIT_PROFILE_SLOTS - 1)){
+        if(half_samples[slot].mem_block != mem_block){
+            continue;
+        }
+        //close the gap: move back every later sample of the run that may no longer be found past it
+        for(next = (slot + 1) & (HALF_FIT_PROFILE_SLOTS - 1); half_samples[next].mem_block != NULL;
+            next = (next + 1) & (HALF_FIT_PROFILE_SLOTS - 1)){
+            want = half_sample_slot(half_samples[next].mem_block);
+            if(((next - want) & (HALF_FIT_PROFILE_SLOTS - 1)) >= ((next - slot) & (HALF_FIT_PROFILE_SLOTS - 1))){
+                half_samples[slot] = half_samples[next];
+                slot = next;
+            }
+        }
+        half_samples[slot].mem_block = NULL;
+        HF_STORE_RELAXED(&half_sample_count, half_sample_count - 1);
+        HF_STORE_RELAXED(&half_sample_marks[home], (unsigned short)(half_sample_marks[home] - 1));
+        break;
+    }
+    HF_PROFILE_LEAVE();
+}
+
+void half_profile_start(size_t rate)
+{
+    void *frame;
+
+    backtrace(&frame, 1); //the first call loads the unwinder, which may allocate
+    HF_PROFILE_ENTER();
+    memset(half_samples, 0, sizeof(half_samples));
+    memset(half_sample_marks, 0, sizeof(half_sample_marks));
+    HF_STORE_RELAXED(&half_sample_count, 0);
+    HF_STORE_RELAXED(&half_profile_generation, half_profile_generation + 1);
+    half_profile_taken_at = (rate == 0) ? (size_t)HALF_FIT_PROFILE_RATE : rate;
+    HF_STORE_RELAXED(&half_profile_rate, half_profile_taken_at);
+    HF_PROFILE_LEAVE();
+}
+
+void half_profile_stop(void)
+{
+    HF_STORE_RELAXED(&half_profile_rate, 0);
+}
+
+//writes frame i of a sample in folded form: the function name backtrace_symbols found, or else the address
+static void half_profile_frame(FILE *f, const char *symbol, void *address)
+{
+    const char *name = (symbol != NULL) ? strchr(symbol, '(') : NULL;
+    size_t length = (name != NULL) ? strcspn(name + 1, "+)") : 0;
+
+    if(length != 0){
+        fprintf(f, "%.*s", (int)length, name + 1);
+    } else {
+        fprintf(f, "%p", address);
+    }
+}
+
+int half_profile_dump(const char *path, int format)
+{
+    half_sample_t *samples;
+    unsigned long long total = 0;
+    char **symbols;
+    size_t rate;
+    U32 count = 0, i, j;
+    FILE *f, *maps;
+    int c;
+
+    //the samples are copied out first: writing the file may allocate, and so sample, which takes the lock
+    samples = (half_sample_t *)malloc(sizeof(half_samples));
+    if(samples == NULL){
+        return -1;
+    }
+    HF_PROFILE_ENTER();
+    for(i = 0; i < HALF_FIT_PROFILE_SLOTS; ++i){
+        if(half_samples[i].mem_block != NULL){
+            samples[count++] = half_samples[i];
+        }
+    }
+    rate = (half_profile_taken_at != 0) ? half_profile_taken_at : (size_t)HALF_FIT_PROFILE_RATE;
+    HF_PROFILE_LEAVE();
+
+    f = fopen(path, "w");
+    if(f == NULL){
+        free(samples);
+        return -1;
+    }
+    if(format == HALF_PROFILE_FOLDED){
+        for(i = 0; i < count; ++i){
+            symbols = backtrace_symbols(samples[i].stack, (int)samples[i].depth);
+            for(j = samples[i].depth; j-- != 0; ){
+                half_profile_frame(f, (symbols != NULL) ? symbols[j] : NULL, samples[i].stack[j]);
+                fputc((j != 0) ? ';' : ' ', f);
+            }
+            //a block of b bytes is sampled with probability 1 - e^(-b / rate)
+            fprintf(f, "%llu\n", (unsigned long long)((double)samples[i].bytes
+                    / (1.0 - half_exp_neg((double)samples[i].bytes / (double)rate)) + 0.5));
+            free(symbols);
+        }
+    } else {
+        for(i = 0; i < count; ++i){
+            total += samples[i].bytes;
+        }
+        fprintf(f, "heap profile: %u: %llu [%u: %llu] @ heap_v2/%llu\n", count, total, count, total,
+                (unsigned long long)rate);
+        for(i = 0; i < count; ++i){
+            fprintf(f, "1: %llu [1: %llu] @", (unsigned long long)samples[i].bytes,
+                    (unsigned long long)samples[i].bytes);
+            for(j = 0; j < samples[i].depth; ++j){
+                fprintf(f, " %p", samples[i].stack[j]);
+            }
+            fputc('\n', f);
+        }
+        //pprof symbolises the addresses with the mappings
+        fprintf(f, "\nMAPPED_LIBRARIES:\n");
+        maps = fopen("/proc/self/maps", "r");
+        if(maps != NULL){
+            while((c = fgetc(maps)) != EOF){
+                fputc(c, f);
+            }
+            fclose(maps);
+        }
+    }
+    free(samples);
+    return (fclose(f) == 0) ? 0 : -1;
+}
+#define HF_PROFILE_ALLOC(mem_block, n)  half_profile_alloc((mem_block), (n))
+#define HF_PROFILE_FREE(mem_block)      half_profile_free(mem_block)
+#else
+#define HF_PROFILE_ALLOC(mem_block, n)  ((void)0)
+#define HF_PROFILE_FREE(mem_block)      ((void)0)
+#endif
+
+char *half_alloc( U32 n)
+{
+    char *mem_block;
+
+    HF_TRACE_ENTER();
+    mem_block = half_heap_alloc(n);
+    HF_PROFILE_ALLOC(mem_block, n);
+    HF_TRACE(HALF_TRACE_ALLOC, n, mem_block);
+    HF_TRACE_LEAVE();
+    return mem_block;
+}
+
+char *half_calloc( U32 count, U32 size)
+{
+    char *mem_block = NULL;
+
+    HF_TRACE_ENTER();
+    if(size == 0 || count <= ~0u / size){
+        mem_block = half_heap_calloc(count * size);
+        HF_PROFILE_ALLOC(mem_block, count * size);
+    }
+    HF_TRACE(HALF_TRACE_ALLOC, count * size, mem_block);
+    HF_TRACE_LEAVE();
+    return mem_block;
+}
+
+void  half_free( char * mem_block)
+{
+    HF_TRACE_ENTER();
+    if(mem_block != NULL){
+        HF_TRACE(HALF_TRACE_FREE, 0, mem_block);
+    }
+    HF_PROFILE_FREE(mem_block);
+    half_heap_free(mem_block);
+    HF_TRACE_LEAVE();
+}
+
+void  half_free_sized( char * mem_block, U32 n)
+{
+    HF_TRACE_ENTER();
+    if(mem_block != NULL){
+        HF_TRACE(HALF_TRACE_FREE, 0, mem_block);
+    }
+    HF_PROFILE_FREE(mem_block);
+    half_heap_free_sized(mem_block, n);
+    HF_TRACE_LEAVE();
+}
+
+char *half_realloc( char * mem_block, U32 n)
+{
+    char *new_block;
+
+    HF_TRACE_ENTER();
+    HF_TRACE(HALF_TRACE_REALLOC, n, mem_block);
+    //the old block loses its sample even if the call fails, since it may be gone once it returns
+    HF_PROFILE_FREE(mem_block);
+    new_block = half_heap_realloc(mem_block, n);
+    HF_PROFILE_ALLOC(new_block, n);
+    HF_TRACE(HALF_TRACE_REALLOC_TO, n, new_block);
+    HF_TRACE_LEAVE();
+    return new_block;
+}
+
+char *half_aligned_alloc( U32 alignment, U32 n)
+{
+    char *mem_block;
+
+    HF_TRACE_ENTER();
+    mem_block = half_heap_aligned_alloc(alignment, n);
+    HF_PROFILE_ALLOC(mem_block, n);
+    //the alignment is a power of two (or the call fails), its log2 goes into bits 15-8 of the op
+    HF_TRACE(HALF_TRACE_ALLOC | ((alignment == 0 ? 0 : 31 - HF_CLZ(alignment)) << 8), n, mem_block);
+    HF_TRACE_LEAVE();
+    return mem_block;
+}
+
+U32 half_alloc_batch( U32 n, U32 count, char **out)
+{
+    U32 filled, i;
+
+    HF_TRACE_ENTER();
+    filled = half_heap_alloc_batch(n, count, out);
+    for(i = 0; i < count; ++i){
+        if(i < filled){
+            HF_PROFILE_ALLOC(out[i], n);
+        }
+        HF_TRACE(HALF_TRACE_ALLOC, n, (i < filled) ? out[i] : NULL);
+    }
+    HF_TRACE_LEAVE();
+    (void)i;
+    return filled;
+}
+
+void  half_free_batch( char **ptrs, U32 count)
+{
+    U32 i;
+
+    HF_TRACE_ENTER();
+    for(i = 0; i < count; ++i){
+        if(ptrs[i] != NULL){
+            HF_TRACE(HALF_TRACE_FREE, 0, ptrs[i]);
+            HF_PROFILE_FREE(ptrs[i]);
+        }
+    }
+    half_heap_free_batch(ptrs, count);
+    HF_TRACE_LEAVE();
+}
+
+size_t half_usable_size_from( half_fit_t *hf, char *mem_block)
+{
+    char *block_addr;
+
+    if(mem_block == NULL){
+        return 0;
+    }
+#if HALF_FIT_SLAB
+    if(half_in_slab(hf, mem_block)){
+        return SLOT_BYTES(SLAB(hf->base_address
+            + ((size_t)(mem_block - hf->base_address) & ~(size_t)(SLAB_BYTES - 1))).cls);
+    }
+#endif
+    (void)hf;
+    block_addr = half_block_of(mem_block);
+    return ((size_t)half_size_of(HEADER(block_addr)) << 5) - (size_t)(mem_block - block_addr);
+}
+
+size_t half_usable_size( char *mem_block)
+{
+#if HALF_FIT_GROW
+    half_fit_t *hf;
+
+    if(mem_block == NULL){
+        return 0;
+    }
+    hf = half_grow_owner(mem_block);
+    if(hf == NULL){
+        return CHUNK_OF(mem_block)->map_bytes - (size_t)(mem_block - (char *)CHUNK_OF(mem_block));
+    }
+    return half_usable_size_from(hf, mem_block);
+#elif HALF_FIT_PER_CPU
+    return (mem_block == NULL) ? 0 : half_usable_size_from(&half_cpu_owner(mem_block)->arena, mem_block);
+#else
+    return half_usable_size_from(&half_fit, mem_block);
+#endif
+}
+
+size_t half_free_bytes( half_fit_t *hf)
+{
+    return (size_t)hf->free_units << 5;
+}
+
+size_t half_largest_free( half_fit_t *hf)
+{
+    U32 largest = 0;
+    U32 offset, next_in_bin;
+    char *block_addr;
+
+    if(hf->bin_bitmap == 0){
+        return 0;
+    }
+
+    //only the highest non-empty bin can hold the largest block, but any block in it may be the one
+    offset = hf->bin_heads[half_top_bin(hf)];
+    for(;;){
+        block_addr = half_address_of(hf, offset);
+        if(half_size_of(HEADER(block_addr)) > largest){
+            largest = half_size_of(HEADER(block_addr));
+        }
+        next_in_bin = half_next_in_bin(block_addr);
+        if(next_in_bin == offset){
+            break; //the tail of a bin links to itself
+        }
+        offset = next_in_bin;
+    }
+
+    return (size_t)largest << 5;
+}
+
+//true when a block of the arena ends where the block at 'offset' starts, as its prev field claims
+static BOOL half_follows(half_fit_t *hf, U32 offset)
+{
+    U32 prev_in_mem = half_prev_of(HEADER(half_address_of(hf, offset)));
+
+    if(offset == 0){
+        return prev_in_mem == 0;
+    }
+    return prev_in_mem < offset && prev_in_mem + half_size_of(HEADER(half_address_of(hf, prev_in_mem))) == offset;
+}
+
+int half_check_arena( half_fit_t *hf)
+{
+    U32 offset, prev_in_mem = 0, size, free_blocks = 0, free_units = 0, binned = 0, binned_units = 0;
+    U32 bin, prev_in_bin, next_in_bin;
+    BOOL prev_free = __FALSE;
+    half_header_t header;
+    char *block_addr;
+#if HALF_FIT_SLAB
+    U32 cls, slabs = 0, listed = 0;
+    BOOL map_found = (hf->slab_map == NO_BLOCK);
+    half_slab_t *slab;
+#endif
+
+    //memory order: each block starts where the one before it ends, knows both neighbours, and no two free blocks
+    //are next to each other
+    for(offset = 0; offset < hf->size; offset += size){
+        header = HEADER(half_address_of(hf, offset));
+        size = half_size_of(header);
+        if(size == 0 || size > hf->size - offset || half_prev_of(header) != prev_in_mem
+            || half_next_of(hf, header, offset) != ((offset + size == hf->size) ? offset : offset + size)){
+            return -1;
+        }
+        if(!half_is_allocated(header)){
+            if(prev_free){
+                return -1;
+            }
+            free_blocks++;
+            free_units += size;
+        }
+#if HALF_FIT_SLAB
+        if(offset == hf->slab_map && half_is_allocated(header)){
+            map_found = __TRUE;
+        }
+#endif
+        prev_free = !half_is_allocated(header);
+        prev_in_mem = offset;
+    }
+    if(free_units != hf->free_units || hf->bins != 32 - HF_CLZ(hf->size) || (hf->bin_bitmap >> hf->bins) != 0){
+        return -1;
+    }
+#if SUB_BIN_BITS
+    for(bin = 0; bin < HALF_FIT_BINS; ++bin){
+        if((hf->sub_bitmaps[bin] != 0) != ((hf->bin_bitmap >> bin) & 1)){
+            return -1;
+        }
+    }
+#endif
+
+    //bins: every free block is in the bin matching its size, exactly once, with both links right
+    for(bin = 0; bin < hf->bins << SUB_BIN_BITS; ++bin){
+        if(!half_bin_used(hf, bin)){
+            continue;
+        }
+        offset = hf->bin_heads[bin];
+        prev_in_bin = offset;
+        for(;;){
+            if(offset >= hf->size || ++binned > free_blocks){
+                return -1;
+            }
+            block_addr = half_address_of(hf, offset);
+            header = HEADER(block_addr);
+            size = half_size_of(header);
+            if(half_is_allocated(header) || size == 0 || half_bin_of(size) != bin
+                || half_prev_in_bin(block_addr) != prev_in_bin || !half_follows(hf, offset)){
+                return -1;
+            }
+            binned_units += size;
+            next_in_bin = half_next_in_bin(block_addr);
+            if(next_in_bin == offset){
+                break;
+            }
+            prev_in_bin = offset;
+            offset = next_in_bin;
+        }
+    }
+    if(binned != free_blocks || binned_units != free_units){
+        return -1;
+    }
+
+#if HALF_FIT_SLAB
+    //slabs: the map is a block of its own, and the lists hold slabs of their size with free slots
+    if(!map_found){
+        return -1;
+    }
+    for(offset = 0; hf->slab_map != NO_BLOCK && offset < hf->size; offset += HALF_FIT_SLAB_UNITS){
+        if(half_in_slab(hf, half_address_of(hf, offset))){
+            slabs++;
+        }
+    }
+    if(slabs != hf->slabs){
+        return -1;
+    }
+    for(cls = 0; cls < HALF_FIT_SLAB_CLASSES; ++cls){
+        prev_in_bin = NO_BLOCK;
+        for(offset = hf->slab_heads[cls]; offset != NO_BLOCK; offset = slab->next_slab){
+            if(offset >= hf->size || offset % HALF_FIT_SLAB_UNITS != 0 || ++listed > slabs
+                || !half_in_slab(hf, half_address_of(hf, offset))){
+                return -1;
+            }
+            slab = &SLAB(half_address_of(hf, offset));
+            if(slab->cls != cls || slab->prev_slab != prev_in_bin || slab->used >= SLOTS(cls)){
+                return -1;
+            }
+            prev_in_bin = offset;
+        }
+    }
+#endif
+    return 0;
+}
+
+#if HALF_FIT_MAPPED || HALF_FIT_SHARED
+/*
+    Heap images, behind mapped and shared heaps. An image is a half_image_t followed by the memory of the arena
+    inside it, and is mapped shared, so the arena, bin heads included, lives in the file or shared memory object and
+    every change to it lands there without any copying. Every link in an arena is an offset from base_address, so
+    wherever the image is mapped, setting base_address is all it takes to use it. The image records the options the
+    allocator was built with and another build refuses it.
+    In a mapped heap 'clean' is cleared while the image is open and set by half_close_mapped once everything else
+    has been written back. An image found unclean was left by a process that died with it open: if
+    half_check_arena finds it inconsistent it is rebuilt from the sizes in its block headers. Walking the sizes
+    finds every block at any point of any call: a block is split by writing the header of the new block first and
+    shrinking the old one last, behind a compiler fence (HF_SIZE_FENCE), and merges only ever grow one header. A
+    block that was being freed at the time may stay allocated for good. This covers a process that dies, in a call
+    or between calls, since the stores it made stay in the mapping; it does not cover the machine going down
+    before the kernel has written the pages back, which would need msync and ordered writes to the disk.
+*/
+#define HALF_IMAGE_MAGIC    "HFHEAP01"
+#define HALF_IMAGE_CONFIG   (((U32)sizeof(half_fit_t) << 12) | HALF_FIT_WIDE_HEADER | (HALF_FIT_ALIGN_16 << 1) \
+                            | (HALF_FIT_SLAB << 2) | (HALF_FIT_THREAD_SAFE << 3) | (HALF_FIT_STATS << 4) \
+                            | (HALF_FIT_SHARED << 5) | (SUB_BIN_BITS << 6))
+
+typedef struct half_image {
+    char magic[8];                      //HALF_IMAGE_MAGIC, written last when the image is made
+    U32 config;                         //HALF_IMAGE_CONFIG of the build that made the image
+    U32 clean;                          //1 while no process has the image open
+    size_t map_bytes;                   //length of the file
+    size_t root;                        //offset of the root from base_address plus one, 0 for none
+#if HALF_FIT_SHARED
+    pthread_mutex_t lock;               //process shared and robust, taken by every half_shared_* call
+#endif
+    half_fit_t arena;
+} half_image_t;
+
+#define IMAGE_HEADER_BYTES  ((sizeof(half_image_t) + 63) & ~(size_t)63)
+#define IMAGE_OF(hf)        ((half_image_t *)((char *)(hf) - offsetof(half_image_t, arena)))
+
+//brings an unclean arena back to a state the allocator can work with: the prev and next fields are rewritten from
+//the sizes, free neighbours are merged, and the bins (and slab lists) are built again from scratch. Returns -1 if
+//the sizes do not add up to the arena
+static int half_rebuild_arena(half_fit_t *hf)
+{
+    U32 offset, size, prev_in_mem = 0;
+    half_header_t header;
+    BOOL allocated;
+    char *block_addr;
+#if HALF_FIT_SLAB
+    BOOL map_found = (hf->slab_map == NO_BLOCK);
+    half_slab_t *slab;
+    U32 cls, free_slots, bits;
+#endif
+
+    for(offset = 0; offset < hf->size; offset += size){
+        header = HEADER(half_address_of(hf, offset));
+        size = half_size_of(header);
+        if(size == 0 || size > hf->size - offset){
+            return -1;
+        }
+#if HALF_FIT_SLAB
+        if(offset == hf->slab_map && half_is_allocated(header)){
+            map_found = __TRUE;
+        }
+#endif
+    }
+#if HALF_FIT_SLAB
+    if(!map_found){
+        return -1; //the slabs cannot be told from other blocks any more
+    }
+    for(cls = 0; cls < HALF_FIT_SLAB_CLASSES; ++cls){
+        hf->slab_heads[cls] = NO_BLOCK;
+    }
+    hf->slabs = 0;
+#endif
+
+    hf->bin_bitmap = 0;
+#if SUB_BIN_BITS
+    memset(hf->sub_bitmaps, 0, sizeof(hf->sub_bitmaps));
+#endif
+    hf->free_units = 0;
+    for(offset = 0; offset < hf->size; offset += size){
+        block_addr = half_address_of(hf, offset);
+        header = HEADER(block_addr);
+        size = half_size_of(header);
+        allocated = half_is_allocated(header);
+        while(!allocated && offset + size < hf->size && !half_is_allocated(HEADER(half_address_of(hf, offset + size)))){
+            size += half_size_of(HEADER(half_address_of(hf, offset + size)));
+        }
+        HEADER(block_addr) = half_make_header(prev_in_mem, (offset + size == hf->size) ? offset : offset + size,
+            size, allocated);
+        if(!allocated){
+            half_bin_insert(hf, block_addr, offset, size);
+        }
+#if HALF_FIT_SLAB
+        if(allocated && hf->slab_map != NO_BLOCK && half_in_slab(hf, block_addr)){
+            slab = &SLAB(block_addr);
+            if(offset % HALF_FIT_SLAB_UNITS != 0 || size != HALF_FIT_SLAB_UNITS || slab->cls >= HALF_FIT_SLAB_CLASSES){
+                return -1;
+            }
+            free_slots = 0;
+            for(bits = slab->free_slots[0]; bits != 0; bits &= bits - 1){
+                free_slots++;
+            }
+            for(bits = slab->free_slots[1]; bits != 0; bits &= bits - 1){
+                free_slots++;
+            }
+            if(free_slots > SLOTS(slab->cls)){
+                return -1;
+            }
+            slab->used = SLOTS(slab->cls) - free_slots;
+            if(free_slots != 0){
+                half_slab_push(hf, block_addr, offset);
+            }
+            hf->slabs++;
+        }
+#endif
+        prev_in_mem = offset;
+    }
+    return 0;
+}
+#endif
+
+#if HALF_FIT_MAPPED
+half_fit_t *half_init_mapped( const char *path, size_t size)
+{
+    half_image_t *image;
+    void *map;
+    int fd, error;
+
+    if(size < IMAGE_HEADER_BYTES + 32){
+        errno = EINVAL;
+        return NULL;
+    }
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if(fd < 0){
+        return NULL;
+    }
+    map = (ftruncate(fd, (off_t)size) == 0) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    error = errno;
+    close(fd); //the mapping keeps the file open
+    if(map == MAP_FAILED){
+        errno = error;
+        return NULL;
+    }
+
+    image = (half_image_t *)map;
+    half_init_arena(&image->arena, (char *)image + IMAGE_HEADER_BYTES, size - IMAGE_HEADER_BYTES);
+    half_mark_zero(image->arena.base_address); //the file was empty
+    image->config = HALF_IMAGE_CONFIG;
+    image->clean = 0;
+    image->map_bytes = size;
+    image->root = 0;
+    memcpy(image->magic, HALF_IMAGE_MAGIC, 8); //a file cut short before this point is never taken for a heap
+    return &image->arena;
+}
+
+half_fit_t *half_open_mapped( const char *path)
+{
+    half_image_t *image;
+    half_fit_t *hf;
+    struct stat st;
+    void *map;
+    int fd, error;
+
+    fd = open(path, O_RDWR);
+    if(fd < 0){
+        return NULL;
+    }
+    if(fstat(fd, &st) != 0){
+        map = MAP_FAILED;
+    } else if((size_t)st.st_size < IMAGE_HEADER_BYTES + 32){
+        map = MAP_FAILED;
+        errno = EINVAL;
+    } else {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    error = errno;
+    close(fd);
+    if(map == MAP_FAILED){
+        errno = error;
+        return NULL;
+    }
+
+    image = (half_image_t *)map;
+    hf = &image->arena;
+    if(memcmp(image->magic, HALF_IMAGE_MAGIC, 8) != 0 || image->config != HALF_IMAGE_CONFIG
+        || image->map_bytes != (size_t)st.st_size || hf->size == 0
+        || hf->size > ((image->map_bytes - IMAGE_HEADER_BYTES) >> 5)){
+        munmap(map, (size_t)st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    //the only pointers in the arena; blocks that were on the remote lists of a thread safe build stay allocated
+    hf->base_address = (char *)image + IMAGE_HEADER_BYTES;
+#if HALF_FIT_THREAD_SAFE
+    hf->owner = NULL;
+    hf->remote_pending = NULL;
+    hf->remote_frees = NULL;
+#endif
+    if(!image->clean && half_check_arena(hf) != 0 && half_rebuild_arena(hf) != 0){
+        munmap(map, image->map_bytes);
+        errno = EIO;
+        return NULL;
+    }
+    image->clean = 0;
+    return hf;
+}
+
+int half_close_mapped( half_fit_t *hf)
+{
+    half_image_t *image = IMAGE_OF(hf);
+
+#if HALF_FIT_THREAD_SAFE
+    half_remote_collect(hf, ~0u);
+#endif
+    //the arena has to be in the file before the flag vouching for it is
+    if(msync(image, image->map_bytes, MS_SYNC) != 0){
+        return -1;
+    }
+    image->clean = 1;
+    if(msync(image, IMAGE_HEADER_BYTES, MS_SYNC) != 0){
+        return -1;
+    }
+    return munmap(image, image->map_bytes);
+}
+
+void half_set_root( half_fit_t *hf, char *mem_block)
+{
+    IMAGE_OF(hf)->root = (mem_block == NULL) ? 0 : (size_t)(mem_block - hf->base_address) + 1;
+}
+
+char *half_get_root( half_fit_t *hf)
+{
+    size_t root = IMAGE_OF(hf)->root;
+
+    return (root == 0) ? NULL : hf->base_address + root - 1;
+}
+#endif
+
+#if HALF_FIT_SHARED
+/*
+    Shared heaps. The image sits in shared memory that several processes map, each at an address of its own, so
+    the base_address stored in the arena is only right for one of them at a time. Every half_shared_* call that
+    touches the arena therefore takes the image's lock and points base_address into its caller's mapping before
+    doing anything else. Blocks travel between processes as handles, their offsets from the base, which mean the
+    same in every mapping. The lock is robust: when a process dies holding it, the next one to take it checks the
+    arena and rebuilds it like an unclean mapped heap; if even that fails the lock is left unrecoverable and every
+    later call fails.
+*/
+//the start of the arena's memory in this process's mapping
+static __inline char *half_shared_base(half_fit_t *hf)
+{
+    return (char *)IMAGE_OF(hf) + IMAGE_HEADER_BYTES;
+}
+
+//takes the lock of a shared arena and makes base_address this process's; returns -1 if the arena is unusable
+static int half_shared_lock(half_fit_t *hf)
+{
+    half_image_t *image = IMAGE_OF(hf);
+    int status = pthread_mutex_lock(&image->lock);
+
+    if(status != 0 && status != EOWNERDEAD){
+        return -1;
+    }
+    hf->base_address = half_shared_base(hf);
+    if(status == EOWNERDEAD){
+        //the last holder died, maybe half way through changing the arena
+        if(half_check_arena(hf) != 0 && half_rebuild_arena(hf) != 0){
+            pthread_mutex_unlock(&image->lock); //unlocked without being made consistent, so it is unusable for good
+            return -1;
+        }
+        pthread_mutex_consistent(&image->lock);
+    }
+    return 0;
+}
+
+half_fit_t *half_init_shared( int fd, size_t size)
+{
+    pthread_mutexattr_t attr;
+    half_image_t *image;
+    void *map;
+
+    if(size < IMAGE_HEADER_BYTES + 32){
+        errno = EINVAL;
+        return NULL;
+    }
+    if(ftruncate(fd, (off_t)size) != 0){
+        return NULL;
+    }
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED){
+        return NULL;
+    }
+
+    image = (half_image_t *)map;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&image->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    half_init_arena(&image->arena, half_shared_base(&image->arena), size - IMAGE_HEADER_BYTES);
+    image->config = HALF_IMAGE_CONFIG;
+    image->map_bytes = size;
+    image->root = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(image->magic, HALF_IMAGE_MAGIC, 8); //last: processes attaching before this point are turned away
+    return &image->arena;
+}
+
+half_fit_t *half_attach_shared( int fd)
+{
+    half_image_t *image;
+    struct stat st;
+    void *map;
+
+    if(fstat(fd, &st) != 0){
+        return NULL;
+    }
+    if((size_t)st.st_size < IMAGE_HEADER_BYTES + 32){
+        errno = EINVAL;
+        return NULL;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED){
+        return NULL;
+    }
+
+    image = (half_image_t *)map;
+    if(memcmp(image->magic, HALF_IMAGE_MAGIC, 8) != 0 || image->config != HALF_IMAGE_CONFIG
+        || image->map_bytes != (size_t)st.st_size){
+        munmap(map, (size_t)st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return &image->arena;
+}
+
+int half_detach_shared( half_fit_t *hf)
+{
+    return munmap(IMAGE_OF(hf), IMAGE_OF(hf)->map_bytes);
+}
+
+char *half_shared_alloc( half_fit_t *hf, U32 n)
+{
+    char *mem_block;
+
+    if(half_shared_lock(hf) != 0){
+        return NULL;
+    }
+    mem_block = half_alloc_from(hf, n);
+    pthread_mutex_unlock(&IMAGE_OF(hf)->lock);
+    return mem_block;
+}
+
+void half_shared_free( half_fit_t *hf, char *mem_block)
+{
+    if(mem_block == NULL || half_shared_lock(hf) != 0){
+        return;
+    }
+    half_free_to(hf, mem_block);
+    pthread_mutex_unlock(&IMAGE_OF(hf)->lock);
+}
+
+size_t half_shared_handle( half_fit_t *hf, char *mem_block)
+{
+    return (mem_block == NULL) ? 0 : (size_t)(mem_block - half_shared_base(hf));
+}
+
+char *half_shared_pointer( half_fit_t *hf, size_t handle)
+{
+    return (handle == 0) ? NULL : half_shared_base(hf) + handle;
+}
+#endif
+
+#if HALF_FIT_STATS
+void half_get_stats_from( half_fit_t *hf, half_stats_t *stats)
+{
+    U32 bin, offset, next_in_bin, size;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->arena_bytes = (size_t)hf->size << 5;
+    stats->free_bytes = half_free_bytes(hf);
+    stats->in_use_bytes = stats->arena_bytes - stats->free_bytes;
+    stats->high_water_bytes = (size_t)hf->high_water << 5;
+    stats->bins = hf->bins;
+    stats->splits = hf->splits;
+    stats->coalesces = hf->coalesces;
+    stats->failed_allocs = hf->failed_allocs;
+
+    for(bin = 0; bin < hf->bins << SUB_BIN_BITS; ++bin){
+        if(!half_bin_used(hf, bin)){
+            continue;
+        }
+        offset = hf->bin_heads[bin];
+        for(;;){
+            size = half_size_of(HEADER(half_address_of(hf, offset)));
+            stats->free_bytes_per_bin[bin >> SUB_BIN_BITS] += (size_t)size << 5;
+            stats->free_blocks_per_bin[bin >> SUB_BIN_BITS]++;
+            stats->free_blocks++;
+            if(((size_t)size << 5) > stats->largest_free){
+                stats->largest_free = (size_t)size << 5;
+            }
+            next_in_bin = half_next_in_bin(half_address_of(hf, offset));
+            if(next_in_bin == offset){
+                break;
+            }
+            offset = next_in_bin;
+        }
+    }
+
+    if(stats->free_bytes != 0){
+        stats->external_fragmentation = 1.0 - (double)stats->largest_free / (double)stats->free_bytes;
+    }
+}
+
+void half_get_stats( half_stats_t *stats)
+{
+#if HALF_FIT_PER_CPU
+    //the sum of the arenas' snapshots; each high-water mark is the arena's own, so their sum is an upper bound
+    half_stats_t part;
+    U32 i, bin;
+
+    memset(stats, 0, sizeof(*stats));
+    for(i = 0; i < half_cpu_count; ++i){
+        pthread_mutex_lock(&half_cpus[i].lock);
+        half_get_stats_from(&half_cpus[i].arena, &part);
+        pthread_mutex_unlock(&half_cpus[i].lock);
+
+        stats->arena_bytes += part.arena_bytes;
+        stats->in_use_bytes += part.in_use_bytes;
+        stats->free_bytes += part.free_bytes;
+        stats->high_water_bytes += part.high_water_bytes;
+        if(part.largest_free > stats->largest_free){
+            stats->largest_free = part.largest_free;
+        }
+        if(part.bins > stats->bins){
+            stats->bins = part.bins;
+        }
+        stats->free_blocks += part.free_blocks;
+        for(bin = 0; bin < part.bins; ++bin){
+            stats->free_bytes_per_bin[bin] += part.free_bytes_per_bin[bin];
+            stats->free_blocks_per_bin[bin] += part.free_blocks_per_bin[bin];
+        }
+        stats->splits += part.splits;
+        stats->coalesces += part.coalesces;
+        stats->failed_allocs += part.failed_allocs;
+    }
+    if(stats->free_bytes != 0){
+        stats->external_fragmentation = 1.0 - (double)stats->largest_free / (double)stats->free_bytes;
+    }
+#else
+#if HALF_FIT_THREAD_SAFE
+    pthread_mutex_lock(&half_fit_lock);
+#endif
+    half_get_stats_from(&half_fit, stats);
+#if HALF_FIT_THREAD_SAFE
+    pthread_mutex_unlock(&half_fit_lock);
+#endif
+#endif
+}
+
+//snprintf that keeps count of what it would have written once buf runs out
+static void half_json_append(char *buf, size_t len, size_t *used, const char *format, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, format);
+    n = vsnprintf(buf + ((*used < len) ? *used : len), (*used < len) ? len - *used : 0, format, args);
+    va_end(args);
+    if(n > 0){
+        *used += (size_t)n;
+    }
+}
+
+int half_stats_json( const half_stats_t *stats, char *buf, size_t len)
+{
+    size_t used = 0;
+    U32 bin;
+
+    half_json_append(buf, len, &used, "{\"arena_bytes\":%lu,\"in_use_bytes\":%lu,\"free_bytes\":%lu,"
+        "\"largest_free\":%lu,\"high_water_bytes\":%lu,\"free_blocks\":%u,\"splits\":%llu,\"coalesces\":%llu,"
+        "\"failed_allocs\":%llu,\"external_fragmentation\":%.4f,\"bins\":[",
+        (unsigned long)stats->arena_bytes, (unsigned long)stats->in_use_bytes, (unsigned long)stats->free_bytes,
+        (unsigned long)stats->largest_free, (unsigned long)stats->high_water_bytes, stats->free_blocks,
+        stats->splits, stats->coalesces, stats->failed_allocs, stats->external_fragmentation);
+    for(bin = 0; bin < stats->bins; ++bin){
+        half_json_append(buf, len, &used, "%s{\"free_bytes\":%lu,\"free_blocks\":%u}", (bin == 0) ? "" : ",",
+            (unsigned long)stats->free_bytes_per_bin[bin], stats->free_blocks_per_bin[bin]);
+    }
+    half_json_append(buf, len, &used, "]}");
+    return (int)used;
+}
+#endif
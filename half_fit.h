@@ -1,20 +1,394 @@
 #ifndef HALF_FIT_H_
 #define HALF_FIT_H_
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef unsigned int       U32;
 
-typedef struct mem_block {
-    char *base_address;
-} mem_block_t;
+/*
+    Header format, chosen at compile time:
+      0  4 byte header with 10 bit offsets, for small embedded arenas of up to 1024 units (32 KiB)
+      1  8 byte header with 32 bit offsets, for arenas of up to 2^30 - 1 units (just under 32 GiB)
+*/
+#ifndef HALF_FIT_WIDE_HEADER
+#define HALF_FIT_WIDE_HEADER    0
+#endif
+
+/*
+    16 byte alignment mode: the header is placed at the end of a 16 byte prefix and the arena base is aligned to 16,
+    so the memory of every block is 16 byte aligned (otherwise it is only guaranteed to be word aligned).
+*/
+#ifndef HALF_FIT_ALIGN_16
+#define HALF_FIT_ALIGN_16       0
+#endif
+
+#if HALF_FIT_WIDE_HEADER
+#define HALF_FIT_HEADER_SIZE    8
+#define HALF_FIT_MAX_UNITS      0x3FFFFFFFu
+#define HALF_FIT_BINS           30
+#else
+#define HALF_FIT_HEADER_SIZE    4
+#define HALF_FIT_MAX_UNITS      1024u
+#define HALF_FIT_BINS           11      // size class i holds free blocks of 2^i to 2^(i+1)-1 units of 32 bytes
+#endif
+
+/*
+    Sub-bins, TLSF style: with HALF_FIT_SUB_BIN_BITS = k above 0, each power of two size class is split into 2^k
+    bins of equal width with a bitmap of their own, so finding a bin still takes two bit scans at most. A request is
+    served from the first bin whose blocks all fit it. In classic Half-Fit (k = 0) that is the next power of two,
+    so a request just over one passes over every block of its own class and splits a block up to twice its size;
+    with sub-bins the bin is within a factor 1 + 2^-k of the request, so big blocks stay whole longer and fewer
+    requests fail while a block that fits is free. Each arena gets 2^k bin heads per class.
+*/
+#ifndef HALF_FIT_SUB_BIN_BITS
+#define HALF_FIT_SUB_BIN_BITS   0
+#endif
+
+#if HALF_FIT_ALIGN_16
+#undef  HALF_FIT_HEADER_SIZE
+#define HALF_FIT_HEADER_SIZE    16      // bytes in front of the memory of every block
+#define HALF_FIT_MIN_ALIGN      16
+#else
+#define HALF_FIT_MIN_ALIGN      4       // alignment of the memory of every block
+#endif
+#define HALF_FIT_MAX_ALIGN      4096    // largest alignment an arena accepts
+
+/*
+    Zeroed memory: half_calloc skips clearing memory the allocator knows is still zero, and clears this many bytes or
+    more with non-temporal stores where the target has them, which leave the cache alone. Below a few MiB the zeros
+    fit in the outer caches and ordinary stores are faster.
+*/
+#ifndef HALF_FIT_STREAM_BYTES
+#define HALF_FIT_STREAM_BYTES   ((size_t)4 << 20)
+#endif
+
+/*
+    Thread safe mode: the default heap behind half_alloc/half_free becomes usable from any number of threads, with a
+    per-thread cache of blocks of 1 to HALF_FIT_CACHE_CLASSES units in front of a locked shared heap. Needs pthreads.
+    Explicit arenas have no lock; each one must only be allocated from by one thread at a time. Once a thread has
+    claimed an arena with half_claim_arena, other threads may half_free_to it too: their blocks are queued on a
+    lock-free list that the owner takes back on its next allocations.
+*/
+#ifndef HALF_FIT_THREAD_SAFE
+#define HALF_FIT_THREAD_SAFE    0
+#endif
+#ifndef HALF_FIT_CACHE_CLASSES
+#define HALF_FIT_CACHE_CLASSES  16      // blocks of up to 16 units (512 bytes) are cached per thread
+#endif
+#ifndef HALF_FIT_CACHE_BATCH
+#define HALF_FIT_CACHE_BATCH    16      // blocks moved from the shared heap per refill
+#endif
+#ifndef HALF_FIT_CACHE_LIMIT
+#define HALF_FIT_CACHE_LIMIT    64      // cached blocks per size before half of them go back to the shared heap
+#endif
+#ifndef HALF_FIT_REMOTE_BATCH
+#define HALF_FIT_REMOTE_BATCH   8       // remotely freed blocks an arena owner takes back per half_alloc_from
+#endif
+
+/*
+    Per-CPU mode, on top of thread safe mode (Linux): instead of the shared heap and its per-thread caches, the
+    default heap is one arena of init_size bytes per CPU, each with its own lock. Allocations go to the arena of the
+    CPU the thread runs on, so the heap holds memory in proportion to the CPUs rather than the threads.
+*/
+#ifndef HALF_FIT_PER_CPU
+#define HALF_FIT_PER_CPU        0
+#endif
+#ifndef HALF_FIT_CPU_ARENAS
+#define HALF_FIT_CPU_ARENAS     64      // most arenas; CPUs past this many share them
+#endif
+
+/*
+    Slab mode: requests of up to HALF_FIT_SLAB_MAX bytes get an 8, 16, 24 or 32 byte slot in a slab of
+    HALF_FIT_SLAB_UNITS units instead of a whole 32 byte unit with its own header, so small objects pack up to four
+    times denser. In thread safe builds this applies to explicit arenas (and the per-CPU ones); half_alloc keeps
+    serving small requests from its per-thread caches.
+*/
+#ifndef HALF_FIT_SLAB
+#define HALF_FIT_SLAB           0
+#endif
+#define HALF_FIT_SLAB_UNITS     16      // a slab is 512 bytes; its first unit holds the header and the slot bitmap
+#define HALF_FIT_SLAB_MAX       32
+#define HALF_FIT_SLAB_CLASSES   (HALF_FIT_SLAB_MAX / 8)
+
+/*
+    Growable default heap, for hosted builds with mmap: when the heap from half_init has no room, the default heap
+    maps chunks of HALF_FIT_CHUNK_SIZE bytes (a power of two) and runs each one as an arena of its own. Requests too
+    big for a chunk get a mapping of their own. Empty chunks are unmapped once they add up to more than the trim
+    threshold, and half_trim gives back everything it can. Not available together with HALF_FIT_THREAD_SAFE.
+*/
+#ifndef HALF_FIT_GROW
+#define HALF_FIT_GROW           0
+#endif
+#ifndef HALF_FIT_CHUNK_SIZE
+#if HALF_FIT_WIDE_HEADER
+#define HALF_FIT_CHUNK_SIZE     0x400000u   // 4 MiB
+#else
+#define HALF_FIT_CHUNK_SIZE     0x8000u     // 32 KiB, about as much as a 4 byte header can describe
+#endif
+#endif
+#ifndef HALF_FIT_TRIM_THRESHOLD
+#define HALF_FIT_TRIM_THRESHOLD (4 * (size_t)HALF_FIT_CHUNK_SIZE) // bytes of empty chunks kept mapped
+#endif
+
+/*
+    Mapped heaps, for hosted builds with mmap: half_init_mapped creates a file holding an arena together with all of
+    its bookkeeping, and half_open_mapped maps it again in a later run with every allocation where it was, without
+    walking anything unless the last process to have it open died without closing it. Allocations should refer to
+    each other by their offset from the arena's base_address, as the file may be mapped elsewhere next time.
+*/
+#ifndef HALF_FIT_MAPPED
+#define HALF_FIT_MAPPED         0
+#endif
+
+/*
+    Shared heaps, for hosted builds with process shared pthread mutexes: half_init_shared runs an arena in a shared
+    memory object (from shm_open or memfd_create) that other processes attach to with half_attach_shared, each
+    mapping it wherever it likes. Blocks are passed between processes as handles, offsets that mean the same in
+    every mapping, so a producer can build a message in place and hand it to a consumer without copying it.
+*/
+#ifndef HALF_FIT_SHARED
+#define HALF_FIT_SHARED         0
+#endif
+
+/*
+    Statistics: with HALF_FIT_STATS set every arena counts its splits, coalesces and failed allocations and remembers
+    its high-water mark, and half_get_stats reports them along with a census of the bins. The counters are plain
+    fields of the arena, updated by whoever already holds it, so they cost an increment each; with the option off
+    they and the functions reading them are compiled out.
+*/
+#ifndef HALF_FIT_STATS
+#define HALF_FIT_STATS          0
+#endif
+
+/*
+    Tracing: with HALF_FIT_TRACE set, half_trace_start records every call to the default heap's functions into a
+    file that half_fit_replay can run against any build of the allocator. Needs a hosted C library.
+*/
+#ifndef HALF_FIT_TRACE
+#define HALF_FIT_TRACE          0
+#endif
+#ifndef HALF_FIT_TRACE_BUFFER
+#define HALF_FIT_TRACE_BUFFER   4096    // records buffered in memory between writes
+#endif
+
+/*
+    Heap profiling: with HALF_FIT_PROFILE set, half_profile_start samples the default heap's allocations, one per
+    HALF_FIT_PROFILE_RATE bytes on average, and records the call stack of every sampled block until it is freed. The
+    bytes between samples are drawn from an exponential distribution, so each byte allocated is equally likely to be
+    picked whatever the size of its block. half_profile_dump writes the sampled blocks still live as a pprof heap
+    profile or as folded stacks for flame graph tools. Needs glibc's backtrace; build with -rdynamic for function
+    names in folded stacks. Allocations and frees cost one extra test while no profile runs.
+*/
+#ifndef HALF_FIT_PROFILE
+#define HALF_FIT_PROFILE        0
+#endif
+#ifndef HALF_FIT_PROFILE_RATE
+#define HALF_FIT_PROFILE_RATE   (512 * 1024) // mean bytes allocated between two samples
+#endif
+#ifndef HALF_FIT_PROFILE_SLOTS
+#define HALF_FIT_PROFILE_SLOTS  4096    // sampled blocks live at once (a power of two); samples past that are dropped
+#endif
+#ifndef HALF_FIT_PROFILE_DEPTH
+#define HALF_FIT_PROFILE_DEPTH  16      // frames kept of each stack
+#endif
+#define HALF_PROFILE_PPROF      0       // pprof's legacy heap profile text, with the process's mappings
+#define HALF_PROFILE_FOLDED     1       // one line per sample: frames outermost first, ';' between, then the bytes
 
+/*
+    Trace file format: a half_trace_header_t followed by records in the order the calls took effect. A realloc is
+    always two records in a row, HALF_TRACE_REALLOC with the old block and HALF_TRACE_REALLOC_TO with the new one.
+    Blocks are identified by their address, 0 standing for NULL (a failed allocation, or a realloc of NULL). Bits
+    15-8 of the op of an aligned allocation hold log2 of its alignment. All fields are in the host's byte order.
+*/
+#define HALF_TRACE_MAGIC        "HFTRACE1"
+#define HALF_TRACE_ALLOC        1
+#define HALF_TRACE_FREE         2
+#define HALF_TRACE_REALLOC      3
+#define HALF_TRACE_REALLOC_TO   4
+
+typedef struct half_trace_header {
+    char  magic[8];                     // HALF_TRACE_MAGIC, without its terminating 0
+    U32   record_size;                  // sizeof(half_trace_record_t) of the writer
+    U32   reserved;
+} half_trace_header_t;
+
+typedef struct half_trace_record {
+    unsigned long long time;            // nanoseconds since half_trace_start
+    unsigned long long id;              // address of the block
+    U32   size;                         // bytes requested, 0 for a free
+    U32   op;                           // HALF_TRACE_*, alignment in bits 15-8
+} half_trace_record_t;
+
+/*
+    One independent heap. Everything the allocator knows about an arena lives here, so a process can run as many
+    arenas as it likes (one per request, per subsystem, per core...). An arena owns no memory of its own: it manages
+    whatever region was handed to half_init_arena, and can be emptied in O(1) with half_reset_arena or simply
+    dropped together with its region without walking any blocks.
+*/
 typedef struct half_fit {
-    mem_block_t *mem_block;
+    char *base_address;                 // start of the managed region
+    U32   size;                         // size of the managed region in 32 byte units (at most HALF_FIT_MAX_UNITS)
+    U32   bins;                         // number of bins this arena can use, floor(log2(size)) + 1
+    U32   bin_bitmap;                   // bit i is set whenever a bin of size class i is non-empty
+    U32   bin_heads[HALF_FIT_BINS << HALF_FIT_SUB_BIN_BITS]; // offset of the first free block in each bin
+#if HALF_FIT_SUB_BIN_BITS
+    U32   sub_bitmaps[HALF_FIT_BINS];   // bit j of word i is set whenever sub-bin j of size class i is non-empty
+#endif
+    U32   free_units;                   // units held by the blocks in the bins
+#if HALF_FIT_STATS
+    U32   high_water;                   // most units ever outside the bins at once
+    unsigned long long splits;          // free blocks cut in two
+    unsigned long long coalesces;       // free blocks merged with a neighbour
+    unsigned long long failed_allocs;   // allocations that returned NULL (a batch that fell short counts once)
+#endif
+#if HALF_FIT_SLAB
+    U32   slab_heads[HALF_FIT_SLAB_CLASSES]; // offset of the first slab with free slots of each size
+    U32   slab_map;                     // offset of the block marking which chunks are slabs, while there are any
+    U32   slabs;                        // slabs in use
+#endif
+#if HALF_FIT_THREAD_SAFE
+    void *owner;                        // thread that claimed the arena, NULL if unclaimed
+    char *remote_pending;               // memory freed by other threads that the owner still has to put back
+    char  pad_1[64];                    // keeps remote_frees off the owner's cache lines
+    char *remote_frees;                 // memory freed by other threads, pushed without any lock
+    char  pad_2[64 - sizeof(char *)];
+#endif
 } half_fit_t;
 
+// The default heap: init_size bytes from calloc (that much per CPU in per-CPU builds), shared by every caller of
+// these three functions. In thread safe builds half_init must not run while other threads are using the heap. If
+// calloc fails every allocation fails, unless the heap can grow
 void  half_init( void );
 char *half_alloc( U32 );
 // or void *half_alloc( unsigned int );
 void  half_free( char * );
+// Memory aligned to 'alignment' bytes, a power of two up to HALF_FIT_MAX_ALIGN (below HALF_FIT_CHUNK_SIZE when the
+// heap can grow, larger ones getting a mapping of their own); NULL for any other alignment.
+// The result is freed and resized like any other block
+char *half_aligned_alloc( U32, U32 );
+// half_free for a block of n bytes from half_alloc or half_realloc (not half_aligned_alloc), n being the size last
+// asked for; knowing it spares a lookup or two
+void  half_free_sized( char *, U32 );
+// Resizes in place when it can, otherwise moves the contents to a new block. NULL behaves like half_alloc, a size of
+// 0 like half_free; when there is no room the old block is left as it was and NULL is returned
+char *half_realloc( char *, U32 );
+// Memory for count objects of 'size' bytes each, all zero; NULL when count * size does not fit 32 bits
+char *half_calloc( U32, U32 );
+// Batches of same sized blocks. half_alloc_batch stores up to count blocks in out[] and returns how many it got;
+// half_free_batch frees every non-NULL pointer in ptrs[], fastest when they are sorted by address
+U32   half_alloc_batch( U32, U32, char ** );
+void  half_free_batch( char **, U32 );
+
+// Explicit arenas. half_init_arena returns 0 on success and -1 when the region cannot hold a single block
+int   half_init_arena( half_fit_t *, void *, size_t );
+void  half_reset_arena( half_fit_t * );
+char *half_alloc_from( half_fit_t *, U32 );
+char *half_calloc_from( half_fit_t *, U32, U32 );
+void  half_free_to( half_fit_t *, char * );
+void  half_free_sized_to( half_fit_t *, char *, U32 );
+char *half_aligned_alloc_from( half_fit_t *, U32, U32 );
+char *half_realloc_from( half_fit_t *, char *, U32 );
+U32   half_alloc_batch_from( half_fit_t *, U32, U32, char ** );
+void  half_free_batch_to( half_fit_t *, char **, U32 );
+#if HALF_FIT_THREAD_SAFE
+void  half_claim_arena( half_fit_t * );
+#endif
+// Walks every block and bin of an arena and returns 0 if they are consistent, -1 if not
+int   half_check_arena( half_fit_t * );
+#if HALF_FIT_STATS
+// A snapshot of one arena. Sizes are in bytes, headers included; blocks held by per-thread caches count as in use
+typedef struct half_stats {
+    size_t arena_bytes;
+    size_t in_use_bytes;
+    size_t free_bytes;
+    size_t largest_free;
+    size_t high_water_bytes;
+    U32    bins;                                    // entries used in the two per-bin arrays, one per size class
+    U32    free_blocks;
+    size_t free_bytes_per_bin[HALF_FIT_BINS];
+    U32    free_blocks_per_bin[HALF_FIT_BINS];
+    unsigned long long splits;
+    unsigned long long coalesces;
+    unsigned long long failed_allocs;
+    double external_fragmentation;                  // 1 - largest_free / free_bytes, 0 with no free memory
+} half_stats_t;
+
+// half_get_stats reports on the default heap, half_get_stats_from on an arena; both walk the free blocks
+void  half_get_stats( half_stats_t * );
+void  half_get_stats_from( half_fit_t *, half_stats_t * );
+// Writes a snapshot as one JSON object into buf, truncated to len bytes; returns the length it needs, like snprintf
+int   half_stats_json( const half_stats_t *, char *, size_t );
+#endif
+
+#if HALF_FIT_GROW
+// Unmaps every empty chunk and gives the pages inside large free blocks back to the OS; returns the bytes released.
+// half_set_trim_threshold sets how many bytes of empty chunks may stay mapped between calls, (size_t)-1 for no limit
+size_t half_trim( void );
+void  half_set_trim_threshold( size_t );
+#endif
+
+// Bytes the caller may use in an allocated block, at least as many as it asked for: of the default heap, and of an
+// arena. 0 for NULL
+size_t half_usable_size( char * );
+size_t half_usable_size_from( half_fit_t *, char * );
+
+// Free space of an arena in bytes, headers included: in total (O(1)), and in its largest block
+size_t half_free_bytes( half_fit_t * );
+size_t half_largest_free( half_fit_t * );
+
+#if HALF_FIT_MAPPED
+// half_init_mapped creates (or truncates) the file at path with 'size' bytes and runs an arena in it; the arena is
+// capped at HALF_FIT_MAX_UNITS units like any other. half_open_mapped maps a file made by a build with the same
+// options; if it was not closed, it is checked and repaired. Both return NULL with errno set on failure, EINVAL for
+// a file that is not a heap of this build and EIO for one damaged beyond repair. One process at a time may have
+// the file open. half_close_mapped writes the arena back, marks the file clean and unmaps it; 0 on success
+half_fit_t *half_init_mapped( const char *, size_t );
+half_fit_t *half_open_mapped( const char * );
+int   half_close_mapped( half_fit_t * );
+// A block (or NULL) recorded in the file of a mapped arena, so the next run can find its way into the data
+void  half_set_root( half_fit_t *, char * );
+char *half_get_root( half_fit_t * );
+#endif
+
+#if HALF_FIT_SHARED
+// half_init_shared sizes the shared memory object open as fd to 'size' bytes and runs an arena in it;
+// half_attach_shared maps one that a build with the same options made. Both return NULL with errno set on failure,
+// EINVAL for an object that is no such heap, and the fd may be closed afterwards. A shared arena is only used
+// through the functions below, which take its lock, never through the half_*_from ones. half_shared_alloc returns
+// NULL when the arena is full or was left beyond repair by a process that died using it
+half_fit_t *half_init_shared( int, size_t );
+half_fit_t *half_attach_shared( int );
+int   half_detach_shared( half_fit_t * );
+char *half_shared_alloc( half_fit_t *, U32 );
+void  half_shared_free( half_fit_t *, char * );
+// The handle of a block, the same in every process attached to the arena (0 for NULL), and the block of a handle
+size_t half_shared_handle( half_fit_t *, char * );
+char *half_shared_pointer( half_fit_t *, size_t );
+#endif
+
+#if HALF_FIT_TRACE
+// Starts writing a trace to the file at path, replacing it; returns 0 on success and -1 if it cannot be opened.
+// A running trace is stopped first. half_trace_stop flushes and closes the file, and also runs at exit
+int   half_trace_start( const char * );
+void  half_trace_stop( void );
+#endif
+
+#if HALF_FIT_PROFILE
+// half_profile_start drops every sample and starts sampling one allocation per 'rate' bytes on average (0 for
+// HALF_FIT_PROFILE_RATE); half_profile_stop stops taking samples, while frees keep dropping theirs.
+// half_profile_dump writes the live samples to the file at path as HALF_PROFILE_PPROF or HALF_PROFILE_FOLDED,
+// scaled up to estimates for the whole heap in folded stacks (pprof scales its own); 0 on success, -1 on failure
+void  half_profile_start( size_t );
+void  half_profile_stop( void );
+int   half_profile_dump( const char *, int );
+#endif
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
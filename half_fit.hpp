@@ -0,0 +1,443 @@
+#ifndef HALF_FIT_HPP_
+#define HALF_FIT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/*
+    Header-only Half-Fit for C++17, with the whole geometry fixed at compile time:
+
+      MinUnitLog2   log2 of the unit, the granule every block size is a multiple of (5: 32 bytes)
+      MaxBlockLog2  log2 of the largest block, and so of the largest arena (15: 32 KiB)
+      HeaderBytes   bytes in front of the memory of every block, a power of two; 0 picks the header word's own
+                    size. The memory of every block is aligned to it
+
+    The bin count, the width of the offsets and of the header word (32 bits while three offsets and a flag fit,
+    64 bits otherwise) and every shift and mask follow from these as constants, so an instantiation compiles down
+    to the same straight-line code the C allocator runs for its own fixed geometry. HalfFit<5, 15> is the C
+    allocator's default arena: same units, same 4 byte header, same bins, and it hands out the same addresses for
+    the same sequence of requests. half_fit.c stays the implementation behind the C API, which still has to build
+    with C compilers for the Cortex-M targets; this header is the engine for C++ code that wants arenas shaped for
+    its own workload.
+
+    Like a C arena, a HalfFit owns no memory and has no lock: it manages the region given to init, and one thread
+    at a time may use it.
+*/
+namespace half_fit_detail {
+
+//index of the highest set bit; x must not be 0
+constexpr unsigned highest_bit(std::uint64_t x)
+{
+#if defined(__GNUC__)
+    return 63u - (unsigned)__builtin_clzll(x);
+#else
+    unsigned bit = 0;
+    while(x >>= 1){
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+//index of the lowest set bit; x must not be 0
+constexpr unsigned lowest_bit(std::uint32_t x)
+{
+#if defined(__GNUC__)
+    return (unsigned)__builtin_ctz(x);
+#else
+    return highest_bit(x & (0u - x));
+#endif
+}
+
+} // namespace half_fit_detail
+
+template <unsigned MinUnitLog2 = 5, unsigned MaxBlockLog2 = 15, std::size_t HeaderBytes = 0>
+class HalfFit {
+public:
+    static constexpr unsigned      kOffsetBits = MaxBlockLog2 - MinUnitLog2;
+    static constexpr std::size_t   kUnit = std::size_t(1) << MinUnitLog2;
+    static constexpr std::uint32_t kMaxUnits = std::uint32_t(1) << kOffsetBits;
+    static constexpr std::size_t   kMaxBlock = std::size_t(1) << MaxBlockLog2;
+    static constexpr unsigned      kBins = kOffsetBits + 1;     // bin i holds free blocks of 2^i to 2^(i+1)-1 units
+
+    // header word: prev_in_mem | next_in_mem | size (kMaxUnits stored as 0) | allocated
+    using Word = std::conditional_t<3 * kOffsetBits + 1 <= 32, std::uint32_t, std::uint64_t>;
+
+    static constexpr std::size_t   kHeaderBytes = (HeaderBytes != 0) ? HeaderBytes : sizeof(Word);
+    static constexpr std::size_t   kAlignment = kHeaderBytes;  // alignment of the memory of every block
+
+    static_assert(MaxBlockLog2 > MinUnitLog2, "the largest block must be bigger than a unit");
+    static_assert(3 * kOffsetBits + 1 <= 64, "too many units for a 64 bit header word");
+    static_assert((kHeaderBytes & (kHeaderBytes - 1)) == 0 && kHeaderBytes >= sizeof(Word),
+                  "HeaderBytes must be a power of two that holds the header word");
+    static_assert(kHeaderBytes + sizeof(Word) <= kUnit, "a free block must hold its header and its bin links");
+
+    HalfFit() = default;
+    HalfFit(void *mem, std::size_t len) { init(mem, len); }
+    HalfFit(const HalfFit &) = delete;
+    HalfFit &operator=(const HalfFit &) = delete;
+
+    // units taken by a block for n bytes; more than kMaxUnits when it could never fit
+    static constexpr std::uint64_t units_for(std::size_t n)
+    {
+        return ((std::uint64_t)n + kHeaderBytes + kUnit - 1) >> MinUnitLog2;
+    }
+
+    // bin a free block of 'units' units lives in
+    static constexpr unsigned bin_of(std::uint32_t units) { return half_fit_detail::highest_bit(units); }
+
+    // first bin whose every block has at least 'units' units
+    static constexpr unsigned fit_bin(std::uint32_t units)
+    {
+        return (units <= 1) ? 0 : half_fit_detail::highest_bit(units - 1) + 1;
+    }
+
+    // manages len bytes at mem, everything past the largest arena left unused; false if not even a unit fits
+    bool init(void *mem, std::size_t len)
+    {
+        char *base = static_cast<char *>(mem);
+        std::size_t skew = (std::size_t)base & (kAlignment - 1);
+
+        if(skew != 0){
+            if(len < kAlignment - skew){
+                size_ = 0;
+                return false;
+            }
+            base += kAlignment - skew;
+            len -= kAlignment - skew;
+        }
+        if(len < kUnit){
+            size_ = 0;
+            return false;
+        }
+        base_ = base;
+        size_ = (len >> MinUnitLog2 >= kMaxUnits) ? kMaxUnits : (std::uint32_t)(len >> MinUnitLog2);
+        reset();
+        return true;
+    }
+
+    // forgets every allocation at once
+    void reset()
+    {
+        bitmap_ = 0;
+        free_units_ = 0;
+        if(size_ != 0){
+            set_header(base_, make_header(0, 0, size_, false));
+            bin_insert(base_, 0, size_);
+        }
+    }
+
+    void *allocate(std::size_t n)
+    {
+        std::uint64_t units = units_for(n);
+        char *block_addr;
+
+        if(units > size_){
+            return nullptr;
+        }
+        block_addr = take_block((std::uint32_t)units);
+        return (block_addr == nullptr) ? nullptr : block_addr + kHeaderBytes;
+    }
+
+    void deallocate(void *mem)
+    {
+        if(mem != nullptr){
+            release_block(static_cast<char *>(mem) - kHeaderBytes);
+        }
+    }
+
+    // resizes in place when it can, otherwise moves; nullptr (with the old block untouched) when there is no room
+    void *reallocate(void *mem, std::size_t n)
+    {
+        char *block_addr;
+        std::size_t old_bytes;
+        void *moved;
+
+        if(mem == nullptr){
+            return allocate(n);
+        }
+        if(n == 0){
+            deallocate(mem);
+            return nullptr;
+        }
+        block_addr = static_cast<char *>(mem) - kHeaderBytes;
+        if(units_for(n) <= size_ && resize_block(block_addr, (std::uint32_t)units_for(n))){
+            return mem;
+        }
+        old_bytes = usable_size(mem);
+        moved = allocate(n);
+        if(moved != nullptr){
+            std::memcpy(moved, mem, (old_bytes < n) ? old_bytes : n);
+            deallocate(mem);
+        }
+        return moved;
+    }
+
+    std::size_t usable_size(const void *mem) const
+    {
+        return ((std::size_t)size_of(header(static_cast<const char *>(mem) - kHeaderBytes)) << MinUnitLog2)
+            - kHeaderBytes;
+    }
+
+    bool owns(const void *mem) const
+    {
+        return (std::size_t)static_cast<const char *>(mem) - (std::size_t)base_ < ((std::size_t)size_ << MinUnitLog2);
+    }
+
+    std::size_t capacity() const { return (std::size_t)size_ << MinUnitLog2; }
+    std::size_t free_bytes() const { return (std::size_t)free_units_ << MinUnitLog2; }
+
+    std::size_t largest_free() const
+    {
+        std::uint32_t largest = 0;
+        std::uint32_t offset, next;
+
+        if(bitmap_ == 0){
+            return 0;
+        }
+        for(offset = heads_[half_fit_detail::highest_bit(bitmap_)]; ; offset = next){
+            if(size_of(header(address_of(offset))) > largest){
+                largest = size_of(header(address_of(offset)));
+            }
+            next = next_in_bin(address_of(offset));
+            if(next == offset){
+                break;
+            }
+        }
+        return (std::size_t)largest << MinUnitLog2;
+    }
+
+private:
+    static constexpr Word     kOffsetMask = (Word(1) << kOffsetBits) - 1;
+    static constexpr unsigned kSizeShift = 1;
+    static constexpr unsigned kNextShift = 1 + kOffsetBits;
+    static constexpr unsigned kPrevShift = 1 + 2 * kOffsetBits;
+
+    char         *base_ = nullptr;
+    std::uint32_t size_ = 0;            // units in the arena
+    std::uint32_t bitmap_ = 0;          // bit i is set whenever bin i is non-empty
+    std::uint32_t free_units_ = 0;
+    std::uint32_t heads_[kBins] = {};
+
+    //the header word sits at the end of the header bytes, the bin links of a free block right after them
+    static Word header(const char *block_addr)
+    {
+        Word word;
+        std::memcpy(&word, block_addr + kHeaderBytes - sizeof(Word), sizeof(Word));
+        return word;
+    }
+    static void set_header(char *block_addr, Word word)
+    {
+        std::memcpy(block_addr + kHeaderBytes - sizeof(Word), &word, sizeof(Word));
+    }
+    static Word links(const char *block_addr)
+    {
+        Word word;
+        std::memcpy(&word, block_addr + kHeaderBytes, sizeof(Word));
+        return word;
+    }
+    static void set_links(char *block_addr, std::uint32_t prev_in_bin, std::uint32_t next_in_bin)
+    {
+        Word word = (Word)prev_in_bin | ((Word)next_in_bin << kOffsetBits);
+        std::memcpy(block_addr + kHeaderBytes, &word, sizeof(Word));
+    }
+
+    static constexpr Word make_header(std::uint32_t prev_in_mem, std::uint32_t next_in_mem, std::uint32_t size,
+                                      bool allocated)
+    {
+        return ((Word)prev_in_mem << kPrevShift) | ((Word)next_in_mem << kNextShift)
+            | (((Word)size & kOffsetMask) << kSizeShift) | (Word)allocated;
+    }
+    static constexpr std::uint32_t prev_of(Word word) { return (std::uint32_t)((word >> kPrevShift) & kOffsetMask); }
+    static constexpr std::uint32_t next_of(Word word) { return (std::uint32_t)((word >> kNextShift) & kOffsetMask); }
+    static constexpr bool is_allocated(Word word) { return (word & 1) != 0; }
+    static constexpr std::uint32_t size_of(Word word)
+    {
+        std::uint32_t size = (std::uint32_t)((word >> kSizeShift) & kOffsetMask);
+        return (size == 0) ? kMaxUnits : size;
+    }
+
+    static std::uint32_t prev_in_bin(const char *block_addr) { return (std::uint32_t)(links(block_addr) & kOffsetMask); }
+    static std::uint32_t next_in_bin(const char *block_addr)
+    {
+        return (std::uint32_t)((links(block_addr) >> kOffsetBits) & kOffsetMask);
+    }
+    static void set_prev_in_mem(char *block_addr, std::uint32_t prev_in_mem)
+    {
+        Word word = header(block_addr);
+        set_header(block_addr, (word & ~(kOffsetMask << kPrevShift)) | ((Word)prev_in_mem << kPrevShift));
+    }
+
+    char *address_of(std::uint32_t offset) const { return base_ + ((std::size_t)offset << MinUnitLog2); }
+    std::uint32_t offset_of(const char *block_addr) const
+    {
+        return (std::uint32_t)((std::size_t)(block_addr - base_) >> MinUnitLog2);
+    }
+
+    void bin_insert(char *block_addr, std::uint32_t offset, std::uint32_t size)
+    {
+        unsigned bin = bin_of(size);
+
+        if(bitmap_ & (1u << bin)){
+            std::uint32_t head = heads_[bin];
+            set_links(block_addr, offset, head);
+            set_links(address_of(head), offset, next_in_bin(address_of(head)));
+        } else {
+            set_links(block_addr, offset, offset);
+            bitmap_ |= 1u << bin;
+        }
+        heads_[bin] = offset;
+        free_units_ += size;
+    }
+
+    void bin_remove(char *block_addr, std::uint32_t offset, std::uint32_t size)
+    {
+        unsigned bin = bin_of(size);
+        std::uint32_t prev = prev_in_bin(block_addr);
+        std::uint32_t next = next_in_bin(block_addr);
+
+        free_units_ -= size;
+        if(prev == offset){
+            if(next == offset){
+                bitmap_ &= ~(1u << bin);
+            } else {
+                set_links(address_of(next), next, next_in_bin(address_of(next)));
+                heads_[bin] = next;
+            }
+        } else if(next == offset){
+            set_links(address_of(prev), prev_in_bin(address_of(prev)), prev);
+        } else {
+            set_links(address_of(prev), prev_in_bin(address_of(prev)), next);
+            set_links(address_of(next), prev, next_in_bin(address_of(next)));
+        }
+    }
+
+    //the same search as half_take_block: the first non-empty bin whose blocks all fit, else the head of the one below
+    char *take_block(std::uint32_t units)
+    {
+        unsigned bin = fit_bin(units);
+        std::uint32_t candidates = bitmap_ & (~0u << bin);
+        std::uint32_t offset, size, next, remainder;
+        char *block_addr;
+        Word word;
+
+        if(candidates != 0){
+            bin = half_fit_detail::lowest_bit(candidates);
+        } else {
+            if(bin == 0 || !(bitmap_ & (1u << (bin - 1)))){
+                return nullptr;
+            }
+            --bin;
+            if(size_of(header(address_of(heads_[bin]))) < units){
+                return nullptr;
+            }
+        }
+
+        offset = heads_[bin];
+        block_addr = address_of(offset);
+        word = header(block_addr);
+        size = size_of(word);
+        bin_remove(block_addr, offset, size);
+
+        if(size > units){
+            next = next_of(word);
+            remainder = offset + units;
+            set_header(address_of(remainder), make_header(offset, (next == offset) ? remainder : next, size - units, false));
+            if(next != offset){
+                set_prev_in_mem(address_of(next), remainder);
+            }
+            bin_insert(address_of(remainder), remainder, size - units);
+            set_header(block_addr, make_header(prev_of(word), remainder, units, true));
+        } else {
+            set_header(block_addr, word | 1);
+        }
+        return block_addr;
+    }
+
+    //frees a block, merging it with free neighbours on either side
+    void release_block(char *block_addr)
+    {
+        std::uint32_t offset = offset_of(block_addr);
+        Word word = header(block_addr);
+        std::uint32_t size = size_of(word);
+        std::uint32_t prev = prev_of(word);
+        std::uint32_t next = next_of(word);
+        Word neighbour;
+
+        if(next != offset){
+            neighbour = header(address_of(next));
+            if(!is_allocated(neighbour)){
+                bin_remove(address_of(next), next, size_of(neighbour));
+                size += size_of(neighbour);
+                if(next_of(neighbour) == next){
+                    next = offset;
+                } else {
+                    next = next_of(neighbour);
+                    set_prev_in_mem(address_of(next), offset);
+                }
+            }
+        }
+        if(prev != offset){
+            neighbour = header(address_of(prev));
+            if(!is_allocated(neighbour)){
+                bin_remove(address_of(prev), prev, size_of(neighbour));
+                size += size_of(neighbour);
+                if(next == offset){
+                    next = prev;
+                } else {
+                    set_prev_in_mem(address_of(next), prev);
+                }
+                block_addr = address_of(prev);
+                offset = prev;
+                prev = prev_of(neighbour);
+            }
+        }
+        set_header(block_addr, make_header(prev, next, size, false));
+        bin_insert(block_addr, offset, size);
+    }
+
+    //grows into a free next neighbour or gives the tail back, without moving
+    bool resize_block(char *block_addr, std::uint32_t units)
+    {
+        std::uint32_t offset = offset_of(block_addr);
+        Word word = header(block_addr);
+        std::uint32_t size = size_of(word);
+        std::uint32_t next = next_of(word);
+        std::uint32_t tail;
+        Word neighbour;
+
+        if(units > size){
+            if(next == offset){
+                return false;
+            }
+            neighbour = header(address_of(next));
+            if(is_allocated(neighbour) || size + size_of(neighbour) < units){
+                return false;
+            }
+            bin_remove(address_of(next), next, size_of(neighbour));
+            size += size_of(neighbour);
+            next = (next_of(neighbour) == next) ? offset : next_of(neighbour);
+            if(next != offset){
+                set_prev_in_mem(address_of(next), offset);
+            }
+        }
+        if(units < size){
+            tail = offset + units;
+            set_header(address_of(tail), make_header(offset, (next == offset) ? tail : next, size - units, true));
+            if(next != offset){
+                set_prev_in_mem(address_of(next), tail);
+            }
+            set_header(block_addr, make_header(prev_of(word), tail, units, true));
+            release_block(address_of(tail));
+        } else {
+            set_header(block_addr, make_header(prev_of(word), next, size, true));
+        }
+        return true;
+    }
+};
+
+using DefaultHalfFit = HalfFit<5, 15>;
+
+#endif
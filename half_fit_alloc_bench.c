@@ -0,0 +1,217 @@
+/*
+	Cycles per half_alloc, and the bin selection the free-bin bitmap replaced:
+
+	    gcc -O2 -o half_fit_alloc_bench half_fit_alloc_bench.c half_fit.c -lm -lpthread
+	    ./half_fit_alloc_bench [-n calls]
+
+	Two parts, each 'calls' times (default 10000000, a tenth of that for the timed calls):
+
+	    select   the bin a request starts from and the first usable bin after it, with only the 32 KiB bin in use,
+	             which is the worst case for the old linear scan: the original ceil(log(n) / log(2)) and scan of
+	             the bin heads against one clz and one ctz of the bitmap, the way half_alloc does it now
+	    alloc    single half_alloc calls on the default heap, each timed on its own and freed again untimed, for a
+	             few fixed sizes: on a fresh heap (one free block, in the top bin) and on a heap kept fragmented by
+	             a random workload of live blocks. The median, p99 and max are printed, with the number of calls
+	             that failed (the fragmented heap may have no room for the largest size)
+
+	Both use rdtsc on x86 and clock_gettime elsewhere; the cost of reading the clock, measured the same way, is
+	taken off the timed calls. The original half_alloc cannot be timed as a whole, as it never split a block and
+	printed on every call, so the bin selection is the part that can be compared.
+*/
+#define _GNU_SOURCE
+#include "half_fit.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNIT				"cycles"
+#else
+#define UNIT				"ns"
+#endif
+
+#define OLD_BINS			11
+#define SIZES				4096	// requests drawn before timing, so the compiler cannot fold them
+#define LIVE				64		// blocks the fragmented heap keeps allocated
+
+/**-----------------------------------------------------------------Clock--------------------------------------------------------------*/
+
+#if defined(__x86_64__) || defined(__i386__)
+static __inline uint64_t ticks( void ) {
+	_mm_lfence();	// keep the read from drifting into the measured operation
+	return __rdtsc();
+}
+#else
+static __inline uint64_t ticks( void ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+#endif
+
+static int compare( const void *a, const void *b ) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return ( x > y ) - ( x < y );
+}
+
+// Median of the cost of reading the clock twice in a row
+static uint64_t clock_overhead( uint64_t *samples, uint32_t n ) {
+	uint32_t i;
+	uint64_t t0;
+
+	for ( i = 0; i < n; ++i ) {
+		t0 = ticks();
+		samples[i] = ticks() - t0;
+	}
+	qsort( samples, n, sizeof( uint64_t ), compare );
+	return samples[n / 2];
+}
+
+/**-----------------------------------------------------------------Bin selection------------------------------------------------------*/
+
+static char *old_bins[OLD_BINS];
+static U32 bitmap;
+static U32 sizes[SIZES];
+
+// The original: the bin from the logarithm of the request and its header, then a scan for a non-empty bin
+static __attribute__( ( noinline ) ) U32 old_select( U32 n ) {
+	U32 bin_index = 0;
+
+	n += 4;
+	if ( n >= 32 ) {
+		bin_index = (U32)ceil( log( n ) / log( 2 ) ) - 5;
+		if ( bin_index > 10 ) return OLD_BINS;
+	}
+	while ( bin_index < OLD_BINS && old_bins[bin_index] == NULL ) {
+		bin_index++;
+	}
+	return bin_index;
+}
+
+// The bitmap: ceil(log2(units)) from one clz, the first non-empty bin from there on from one ctz
+static __attribute__( ( noinline ) ) U32 new_select( U32 n ) {
+	U32 units = ( n + 4 + 31 ) >> 5;
+	U32 start = ( units <= 1 ) ? 0 : 32 - (U32)__builtin_clz( units - 1 );
+	U32 classes = ( start >= 32 ) ? 0 : bitmap & ( ~0u << start );
+
+	return ( classes == 0 ) ? OLD_BINS : (U32)__builtin_ctz( classes );
+}
+
+static double time_select( U32 ( *select )( U32 ), uint32_t calls ) {
+	volatile U32 sink = 0;
+	uint64_t t0;
+	uint32_t i;
+
+	t0 = ticks();
+	for ( i = 0; i < calls; ++i ) {
+		sink += select( sizes[i & ( SIZES - 1 )] );
+	}
+	(void)sink;
+	return (double)( ticks() - t0 ) / calls;
+}
+
+/**-----------------------------------------------------------------Single half_alloc--------------------------------------------------*/
+
+static void report( const char *label, U32 n, uint64_t *samples, uint32_t count, uint64_t overhead, uint32_t failed ) {
+	uint32_t i;
+
+	for ( i = 0; i < count; ++i ) {
+		samples[i] = ( samples[i] > overhead ) ? samples[i] - overhead : 0;
+	}
+	qsort( samples, count, sizeof( uint64_t ), compare );
+	printf( "%-12s %6u B %10llu %10llu %10llu %10u\n", label, n, (unsigned long long)samples[count / 2],
+			(unsigned long long)samples[(uint64_t)count * 99 / 100], (unsigned long long)samples[count - 1], failed );
+}
+
+// Every call finds the heap as one free block, so the search starts far below the only non-empty bin. Both return
+// how many calls failed
+static uint32_t time_fresh( U32 n, uint64_t *samples, uint32_t count ) {
+	uint32_t i, failed = 0;
+	uint64_t t0;
+	char *p;
+
+	half_init();
+	for ( i = 0; i < count; ++i ) {
+		t0 = ticks();
+		p = half_alloc( n );
+		samples[i] = ticks() - t0;
+		failed += ( p == NULL );
+		half_free( p );
+	}
+	return failed;
+}
+
+// LIVE blocks of up to 512 bytes stay allocated and one of them is replaced before every timed call, so free blocks
+// of many sizes are spread over the bins
+static uint32_t time_fragmented( U32 n, uint64_t *samples, uint32_t count ) {
+	char *live[LIVE] = { 0 };
+	uint32_t i, k, failed = 0;
+	uint64_t t0;
+	char *p;
+
+	half_init();
+	srand( 1 );
+	for ( i = 0; i < count; ++i ) {
+		k = (uint32_t)rand() % LIVE;
+		half_free( live[k] );
+		live[k] = half_alloc( sizes[(uint32_t)rand() & ( SIZES - 1 )] % 512 + 1 );
+
+		t0 = ticks();
+		p = half_alloc( n );
+		samples[i] = ticks() - t0;
+		failed += ( p == NULL );
+		half_free( p );
+	}
+	for ( k = 0; k < LIVE; ++k ) {
+		half_free( live[k] );
+	}
+	return failed;
+}
+
+int main( int argc, char **argv ) {
+	static const U32 fixed[] = { 1, 100, 1000, 8000 };
+	uint32_t calls = 10000000, timed, failed, i;
+	uint64_t *samples, overhead;
+
+	if ( argc > 2 && strcmp( argv[1], "-n" ) == 0 ) calls = (uint32_t)strtoul( argv[2], NULL, 0 );
+	timed = calls / 10;
+	if ( timed == 0 ) {
+		fprintf( stderr, "usage: %s [-n calls]\n", argv[0] );
+		return 2;
+	}
+	samples = (uint64_t *)malloc( timed * sizeof( uint64_t ) );
+	if ( samples == NULL ) return 1;
+
+	// Requests of 1 byte to 8 KiB, spread evenly over the power of two classes
+	srand( 1 );
+	for ( i = 0; i < SIZES; ++i ) {
+		sizes[i] = ( 1u << ( rand() % 13 ) ) + (U32)rand() % ( 1u << ( rand() % 13 ) );
+	}
+	memset( old_bins, 0, sizeof( old_bins ) );
+	old_bins[OLD_BINS - 1] = (char *)&old_bins;
+	bitmap = 1u << ( OLD_BINS - 1 );
+
+	printf( "bin selection, %u calls, only the 32 KiB bin in use (%s per call)\n", calls, UNIT );
+	printf( "  log() + linear scan  %8.1f\n", time_select( old_select, calls ) );
+	printf( "  bitmap + clz/ctz     %8.1f\n\n", time_select( new_select, calls ) );
+
+	overhead = clock_overhead( samples, timed );
+	printf( "single half_alloc, %u calls each, clock overhead of %llu %s taken off\n", timed,
+			(unsigned long long)overhead, UNIT );
+	printf( "%-12s %8s %10s %10s %10s %10s\n", "heap", "request", "median", "p99", "max", "failed" );
+	for ( i = 0; i < sizeof( fixed ) / sizeof( fixed[0] ); ++i ) {
+		failed = time_fresh( fixed[i], samples, timed );
+		report( "fresh", fixed[i], samples, timed, overhead, failed );
+	}
+	for ( i = 0; i < sizeof( fixed ) / sizeof( fixed[0] ); ++i ) {
+		failed = time_fragmented( fixed[i], samples, timed );
+		report( "fragmented", fixed[i], samples, timed, overhead, failed );
+	}
+	free( samples );
+	return 0;
+}
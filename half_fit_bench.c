@@ -0,0 +1,539 @@
+/*
+	Benchmark harness for hosted (Linux) builds, the counterpart of half_fit_test.c that needs no Cortex-M board.
+
+	    gcc -O2 -o half_fit_bench half_fit_bench.c half_fit.c -lpthread
+	    ./half_fit_bench [-w fifo|lifo|random|prodcons|threads|all] [-s fixed|powerlaw] [-b bytes] [-n ops] [-l live]
+	                     [-t threads]
+
+	Every workload is generated once as a script of allocations and frees and then run against a Half-Fit arena and
+	against the C library's malloc/free, so both see exactly the same requests. Each run is done twice: once
+	untimed for throughput, and once with every operation timed (rdtsc on x86, clock_gettime elsewhere) for the
+	p50/p99/p99.9/max latencies. The latencies include the cost of reading the clock, about the same for both.
+
+	    fifo      'live' blocks stay allocated; each step frees the oldest one and allocates a new one
+	    lifo      bursts of 1 to 'live' allocations, freed in reverse order
+	    random    'live' blocks stay allocated; each step frees a random one and allocates a new one
+	    prodcons  one thread allocates, another frees what it is handed (needs HALF_FIT_THREAD_SAFE=1)
+	    threads   'threads' threads (default 64) run the random workload at once on the default heap, the 'live'
+	              blocks split between them (needs HALF_FIT_THREAD_SAFE=1)
+
+	Sizes are either fixed ('bytes') or drawn from the power-law distribution of get_random_block_size in the test
+	suite. The arena is the largest the header format allows (32 KiB for the default header, 64 MiB for the wide
+	one), so the power-law sizes do run the default arena out of memory now and then; failed allocations are
+	counted and their frees skipped.
+
+	The threads workload compares the two designs of the thread safe default heap, a shared heap behind per-thread
+	caches (HALF_FIT_THREAD_SAFE=1) and one arena per CPU (HALF_FIT_PER_CPU=1 as well), built one at a time. It is
+	timed as a whole, and then, with every thread still alive but all of its blocks freed, the memory the heap still
+	counts as in use is what the design holds back idle; built with HALF_FIT_STATS=1 it is reported as 'held'. The
+	heap gets the same memory in total in both designs.
+*/
+#define _GNU_SOURCE
+#include "half_fit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#if HALF_FIT_THREAD_SAFE
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define smlst_blk			5
+#define	lrgst_blk			15
+
+#if HALF_FIT_WIDE_HEADER
+#define ARENA_SIZE			( (size_t)64 << 20 )
+#define DEFAULT_LIVE		4096
+#else
+#define ARENA_SIZE			( (size_t)HALF_FIT_MAX_UNITS << 5 )
+#define DEFAULT_LIVE		64
+#endif
+
+/**-----------------------------------------------------------------Clock--------------------------------------------------------------*/
+
+#if defined(__x86_64__) || defined(__i386__)
+static __inline uint64_t ticks( void ) {
+	_mm_lfence();	// keep the read from drifting into the measured operation
+	return __rdtsc();
+}
+#else
+static __inline uint64_t ticks( void ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+#endif
+
+static uint64_t now_ns( void ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static double ns_per_tick;
+
+// Measures the tick rate against the monotonic clock over 50 ms
+static void calibrate( void ) {
+	uint64_t t0 = now_ns(), c0 = ticks();
+
+	while ( now_ns() - t0 < 50000000u ) {
+	}
+	ns_per_tick = (double)( now_ns() - t0 ) / (double)( ticks() - c0 );
+}
+
+/**-----------------------------------------------------------------Allocators---------------------------------------------------------*/
+
+typedef struct allocator {
+	const char *name;
+	void  (*reset)( void );
+	char *(*alloc)( U32 );
+	void  (*release)( char * );
+} allocator_t;
+
+static half_fit_t arena;
+static char *arena_mem;
+
+static void  hf_reset( void )			{ half_reset_arena( &arena ); }
+static char *hf_alloc( U32 n )			{ return half_alloc_from( &arena, n ); }
+static void  hf_release( char *p )		{ half_free_to( &arena, p ); }
+
+static void  libc_reset( void )			{ }
+static char *libc_alloc( U32 n )		{ return (char *)malloc( n ); }
+static void  libc_release( char *p )	{ free( p ); }
+
+static const allocator_t allocators[] = {
+	{ "half_fit", hf_reset,   hf_alloc,   hf_release },
+	{ "malloc",   libc_reset, libc_alloc, libc_release },
+};
+
+#if HALF_FIT_THREAD_SAFE
+// The default heap, for the threads workload; its size is set before half_init
+extern U32 init_size;
+
+static const allocator_t heap_allocators[] = {
+	{ "half_fit", half_init,  half_alloc, half_free },
+	{ "malloc",   libc_reset, libc_alloc, libc_release },
+};
+#endif
+
+/**-----------------------------------------------------------------Workloads----------------------------------------------------------*/
+
+// One step of a script: allocate 'size' bytes into 'slot', or free 'slot' when size is 0
+typedef struct op {
+	uint32_t slot;
+	uint32_t size;
+} op_t;
+
+static int power_law;
+static uint32_t fixed_size = 64;
+
+static uint32_t log_2( uint32_t n ) {
+	return 31 - __builtin_clz( n );
+}
+
+// Same distribution as get_random_block_size in half_fit_test.c: a block size in (2^r, 2^(r+1)], smaller r more likely
+static uint32_t get_random_block_size( void ) {
+	uint32_t r_num = rand() % ( ( 1 << ( lrgst_blk - smlst_blk ) ) - 1 ) + 1;
+
+	r_num = ( lrgst_blk - 1 ) - log_2( r_num );
+	return ( rand() % ( 1 << r_num ) ) + ( 1 << r_num ) + 1;
+}
+
+static uint32_t next_size( void ) {
+	return power_law ? get_random_block_size() : fixed_size;
+}
+
+// Each generator fills at most 'len' steps and returns how many it used; every block allocated is freed again
+static size_t gen_fifo( op_t *ops, size_t len, uint32_t live ) {
+	size_t n = 0;
+	uint32_t i;
+
+	for ( i = 0; i < live && n < len; ++i ) {
+		ops[n].slot = i; ops[n++].size = next_size();
+	}
+	for ( i = 0; n + live + 2 <= len; i = ( i + 1 ) % live ) {
+		ops[n].slot = i; ops[n++].size = 0;
+		ops[n].slot = i; ops[n++].size = next_size();
+	}
+	for ( i = 0; i < live; ++i ) {
+		ops[n].slot = i; ops[n++].size = 0;
+	}
+	return n;
+}
+
+static size_t gen_random( op_t *ops, size_t len, uint32_t live ) {
+	size_t n = 0;
+	uint32_t i;
+
+	for ( i = 0; i < live && n < len; ++i ) {
+		ops[n].slot = i; ops[n++].size = next_size();
+	}
+	while ( n + live + 2 <= len ) {
+		i = rand() % live;
+		ops[n].slot = i; ops[n++].size = 0;
+		ops[n].slot = i; ops[n++].size = next_size();
+	}
+	for ( i = 0; i < live; ++i ) {
+		ops[n].slot = i; ops[n++].size = 0;
+	}
+	return n;
+}
+
+static size_t gen_lifo( op_t *ops, size_t len, uint32_t live ) {
+	size_t n = 0;
+	uint32_t i, burst;
+
+	for ( ;; ) {
+		burst = rand() % live + 1;
+		if ( n + 2 * burst > len ) {
+			return n;
+		}
+		for ( i = 0; i < burst; ++i ) {
+			ops[n].slot = i; ops[n++].size = next_size();
+		}
+		while ( i-- != 0 ) {
+			ops[n].slot = i; ops[n++].size = 0;
+		}
+	}
+}
+
+/**-----------------------------------------------------------------Runs and reports---------------------------------------------------*/
+
+typedef struct result {
+	double   mops;			// million operations per second, untimed run
+	uint64_t *alloc_lat;	// ticks per allocation, timed run
+	uint64_t *free_lat;
+	size_t   allocs, frees, fails;
+} result_t;
+
+static int cmp_u64( const void *a, const void *b ) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return ( x > y ) - ( x < y );
+}
+
+static double percentile_ns( uint64_t *lat, size_t n, double p ) {
+	return n == 0 ? 0.0 : (double)lat[(size_t)( ( n - 1 ) * p )] * ns_per_tick;
+}
+
+static void print_header( void ) {
+	printf( "%-18s %-9s %8s | %-30s | %-30s | %s\n", "workload", "allocator", "Mops/s",
+	        "alloc ns  p50   p99 p99.9    max", "free ns   p50   p99 p99.9    max", "failed" );
+}
+
+static void print_result( const char *workload, const char *name, result_t *r ) {
+	qsort( r->alloc_lat, r->allocs, sizeof(uint64_t), cmp_u64 );
+	qsort( r->free_lat, r->frees, sizeof(uint64_t), cmp_u64 );
+	printf( "%-18s %-9s %8.2f | %8.0f %5.0f %5.0f %8.0f | %8.0f %5.0f %5.0f %8.0f | %zu\n", workload, name, r->mops,
+	        percentile_ns( r->alloc_lat, r->allocs, 0.5 ), percentile_ns( r->alloc_lat, r->allocs, 0.99 ),
+	        percentile_ns( r->alloc_lat, r->allocs, 0.999 ), percentile_ns( r->alloc_lat, r->allocs, 1.0 ),
+	        percentile_ns( r->free_lat, r->frees, 0.5 ), percentile_ns( r->free_lat, r->frees, 0.99 ),
+	        percentile_ns( r->free_lat, r->frees, 0.999 ), percentile_ns( r->free_lat, r->frees, 1.0 ), r->fails );
+}
+
+static void run_script( const allocator_t *a, const op_t *ops, size_t n, char **slots, result_t *r ) {
+	uint64_t t;
+	size_t i;
+
+	// Throughput: no clock reads between the operations
+	a->reset();
+	t = now_ns();
+	for ( i = 0; i < n; ++i ) {
+		if ( ops[i].size != 0 ) {
+			slots[ops[i].slot] = a->alloc( ops[i].size );
+		} else if ( slots[ops[i].slot] != NULL ) {
+			a->release( slots[ops[i].slot] );
+			slots[ops[i].slot] = NULL;
+		}
+	}
+	r->mops = (double)n * 1000.0 / (double)( now_ns() - t );
+
+	// Latency: the same script again, every operation timed on its own
+	a->reset();
+	r->allocs = r->frees = r->fails = 0;
+	for ( i = 0; i < n; ++i ) {
+		if ( ops[i].size != 0 ) {
+			t = ticks();
+			slots[ops[i].slot] = a->alloc( ops[i].size );
+			r->alloc_lat[r->allocs++] = ticks() - t;
+			r->fails += slots[ops[i].slot] == NULL;
+		} else if ( slots[ops[i].slot] != NULL ) {
+			t = ticks();
+			a->release( slots[ops[i].slot] );
+			r->free_lat[r->frees++] = ticks() - t;
+			slots[ops[i].slot] = NULL;
+		}
+	}
+}
+
+#if HALF_FIT_THREAD_SAFE
+/*
+	Producer/consumer: the producer owns the arena (half_claim_arena) and allocates; the consumer frees what it takes
+	off a single-producer single-consumer ring, so every Half-Fit free is a remote one. At most 'live' blocks are in
+	flight. Both sides yield while they wait, so the run also makes progress on a single core.
+*/
+#define RING_SIZE	1024
+
+typedef struct pc_run {
+	const allocator_t *a;
+	size_t n, live;
+	char *ring[RING_SIZE];
+	size_t head, tail;		// written by the producer and the consumer respectively
+	result_t *r;
+} pc_run_t;
+
+static void *pc_consumer( void *arg ) {
+	pc_run_t *pc = (pc_run_t *)arg;
+	size_t taken = 0, tail = 0;
+	uint64_t t;
+	char *p;
+
+	while ( taken < pc->n ) {
+		if ( tail == __atomic_load_n( &pc->head, __ATOMIC_ACQUIRE ) ) {
+			sched_yield();
+			continue;
+		}
+		p = pc->ring[tail % RING_SIZE];
+		__atomic_store_n( &pc->tail, ++tail, __ATOMIC_RELEASE );
+		taken++;
+		if ( p != NULL ) {
+			t = ticks();
+			pc->a->release( p );
+			pc->r->free_lat[pc->r->frees++] = ticks() - t;
+		}
+	}
+	return NULL;
+}
+
+static void run_prodcons( const allocator_t *a, const uint32_t *sizes, size_t n, size_t live, result_t *r ) {
+	static pc_run_t pc;
+	pthread_t consumer;
+	uint64_t t, start;
+	size_t i;
+	char *p;
+
+	a->reset();
+	half_claim_arena( &arena );
+	memset( &pc, 0, sizeof(pc) );
+	pc.a = a;
+	pc.n = n;
+	pc.live = ( live < RING_SIZE ) ? live : RING_SIZE;
+	pc.r = r;
+	r->allocs = r->frees = r->fails = 0;
+
+	pthread_create( &consumer, NULL, pc_consumer, &pc );
+	start = now_ns();
+	for ( i = 0; i < n; ++i ) {
+		while ( i - __atomic_load_n( &pc.tail, __ATOMIC_ACQUIRE ) >= pc.live ) {
+			sched_yield();
+		}
+		t = ticks();
+		p = a->alloc( sizes[i] );
+		r->alloc_lat[r->allocs++] = ticks() - t;
+		r->fails += p == NULL;
+		pc.ring[i % RING_SIZE] = p;
+		__atomic_store_n( &pc.head, i + 1, __ATOMIC_RELEASE );
+	}
+	pthread_join( consumer, NULL );
+	r->mops = (double)( 2 * n ) * 1000.0 / (double)( now_ns() - start );	// allocations and frees
+}
+
+typedef struct mt_run {
+	const allocator_t *a;
+	const op_t *ops;
+	size_t n;
+	uint32_t live;
+	pthread_barrier_t start, freed, measured;
+} mt_run_t;
+
+static void *mt_worker( void *arg ) {
+	mt_run_t *mt = (mt_run_t *)arg;
+	char **slots = (char **)calloc( mt->live, sizeof(char *) );
+	size_t i;
+
+	pthread_barrier_wait( &mt->start );
+	for ( i = 0; i < mt->n; ++i ) {
+		if ( mt->ops[i].size != 0 ) {
+			slots[mt->ops[i].slot] = mt->a->alloc( mt->ops[i].size );
+		} else if ( slots[mt->ops[i].slot] != NULL ) {
+			mt->a->release( slots[mt->ops[i].slot] );
+			slots[mt->ops[i].slot] = NULL;
+		}
+	}
+	pthread_barrier_wait( &mt->freed );
+	pthread_barrier_wait( &mt->measured );	// stays alive, caches and all, until the heap has been looked at
+	free( slots );
+	return NULL;
+}
+
+// Runs the script on 'threads' threads at once; returns Mops/s and stores the bytes the heap holds afterwards
+static double run_threads( const allocator_t *a, const op_t *ops, size_t n, uint32_t live, unsigned threads, size_t *held ) {
+	static mt_run_t mt;
+	pthread_t *ids = (pthread_t *)malloc( threads * sizeof(pthread_t) );
+	uint64_t start, elapsed;
+	unsigned t;
+#if HALF_FIT_STATS
+	half_stats_t st;
+#endif
+
+	a->reset();
+	mt.a = a;
+	mt.ops = ops;
+	mt.n = n;
+	mt.live = live;
+	pthread_barrier_init( &mt.start, NULL, threads + 1 );
+	pthread_barrier_init( &mt.freed, NULL, threads + 1 );
+	pthread_barrier_init( &mt.measured, NULL, threads + 1 );
+	for ( t = 0; t < threads; ++t ) {
+		pthread_create( &ids[t], NULL, mt_worker, &mt );
+	}
+
+	start = now_ns();	// on a busy machine the threads may well run before this one returns from the barrier
+	pthread_barrier_wait( &mt.start );
+	pthread_barrier_wait( &mt.freed );
+	elapsed = now_ns() - start;
+	*held = 0;
+#if HALF_FIT_STATS
+	if ( a->alloc == half_alloc ) {
+		half_get_stats( &st );
+		*held = st.in_use_bytes;
+	}
+#endif
+	pthread_barrier_wait( &mt.measured );
+
+	for ( t = 0; t < threads; ++t ) {
+		pthread_join( ids[t], NULL );
+	}
+	pthread_barrier_destroy( &mt.start );
+	pthread_barrier_destroy( &mt.freed );
+	pthread_barrier_destroy( &mt.measured );
+	free( ids );
+	return (double)n * threads * 1000.0 / (double)elapsed;
+}
+#endif
+
+/**-----------------------------------------------------------------Main---------------------------------------------------------------*/
+
+int main( int argc, char **argv ) {
+	static const char *workloads[] = { "fifo", "lifo", "random", "prodcons", "threads" };
+	const char *only = "all";
+	size_t n_ops = 1000000, n, w, k;
+	uint32_t live = DEFAULT_LIVE;
+	unsigned threads = 64;
+	char label[32];
+	op_t *ops;
+	uint32_t *sizes;
+	char **slots;
+	result_t r;
+	int opt;
+
+	while ( ( opt = getopt( argc, argv, "w:s:b:n:l:t:" ) ) != -1 ) {
+		switch ( opt ) {
+		case 'w': only = optarg; break;
+		case 's': power_law = strcmp( optarg, "powerlaw" ) == 0; break;
+		case 'b': fixed_size = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 'n': n_ops = strtoul( optarg, NULL, 0 ); break;
+		case 'l': live = (uint32_t)strtoul( optarg, NULL, 0 ); break;
+		case 't': threads = (unsigned)strtoul( optarg, NULL, 0 ); break;
+		default:
+			fprintf( stderr, "usage: %s [-w fifo|lifo|random|prodcons|threads|all] [-s fixed|powerlaw] [-b bytes] [-n ops] [-l live] [-t threads]\n", argv[0] );
+			return 2;
+		}
+	}
+	if ( live == 0 || n_ops < 2 * (size_t)live + 2 ) {
+		fprintf( stderr, "need at least 2 * live + 2 operations\n" );
+		return 2;
+	}
+	if ( threads == 0 ) {
+		fprintf( stderr, "need at least one thread\n" );
+		return 2;
+	}
+
+	arena_mem = (char *)malloc( ARENA_SIZE );
+	ops = (op_t *)malloc( n_ops * sizeof(op_t) );
+	sizes = (uint32_t *)malloc( n_ops * sizeof(uint32_t) );
+	slots = (char **)calloc( live, sizeof(char *) );
+	r.alloc_lat = (uint64_t *)malloc( n_ops * sizeof(uint64_t) );
+	r.free_lat = (uint64_t *)malloc( n_ops * sizeof(uint64_t) );
+	if ( arena_mem == NULL || ops == NULL || sizes == NULL || slots == NULL || r.alloc_lat == NULL || r.free_lat == NULL
+	  || half_init_arena( &arena, arena_mem, ARENA_SIZE ) != 0 ) {
+		fprintf( stderr, "out of memory\n" );
+		return 1;
+	}
+
+	calibrate();
+	printf( "%zu ops, %s sizes", n_ops, power_law ? "power-law" : "fixed" );
+	if ( !power_law ) {
+		printf( " of %u bytes", fixed_size );
+	}
+	printf( ", %u live blocks, %zu byte arena, %.3f ns per tick\n\n", live, (size_t)ARENA_SIZE, ns_per_tick );
+	print_header();
+
+	for ( w = 0; w < sizeof(workloads) / sizeof(workloads[0]); ++w ) {
+		if ( strcmp( only, "all" ) != 0 && strcmp( only, workloads[w] ) != 0 ) {
+			continue;
+		}
+		snprintf( label, sizeof(label), "%s/%s", workloads[w], power_law ? "powerlaw" : "fixed" );
+
+		srand( 1 );
+		if ( w == 3 ) {
+#if HALF_FIT_THREAD_SAFE
+			for ( n = 0; n < n_ops / 2; ++n ) {
+				sizes[n] = next_size();
+			}
+			for ( k = 0; k < sizeof(allocators) / sizeof(allocators[0]); ++k ) {
+				run_prodcons( &allocators[k], sizes, n_ops / 2, live, &r );
+				print_result( label, allocators[k].name, &r );
+			}
+#else
+			printf( "%-18s skipped, needs HALF_FIT_THREAD_SAFE=1\n", label );
+#endif
+			continue;
+		}
+		if ( w == 4 ) {
+#if HALF_FIT_THREAD_SAFE
+			uint32_t per_thread = ( live / threads > 0 ) ? live / threads : 1;
+			size_t held;
+			double mops;
+
+			// the same memory in total: split between the CPUs' arenas, or all in the shared heap
+#if HALF_FIT_PER_CPU
+			long cpus = sysconf( _SC_NPROCESSORS_CONF );
+
+			init_size = (U32)( ARENA_SIZE / (size_t)( ( cpus < 1 ) ? 1 : ( cpus > HALF_FIT_CPU_ARENAS ) ? HALF_FIT_CPU_ARENAS : cpus ) );
+#else
+			init_size = (U32)ARENA_SIZE;
+#endif
+			n = gen_random( ops, n_ops / threads, per_thread );
+			for ( k = 0; k < sizeof(heap_allocators) / sizeof(heap_allocators[0]); ++k ) {
+				mops = run_threads( &heap_allocators[k], ops, n, per_thread, threads, &held );
+				printf( "%-18s %-9s %8.2f | %u threads, %u live blocks each", label, heap_allocators[k].name, mops, threads, per_thread );
+#if HALF_FIT_STATS
+				if ( k == 0 ) {
+					printf( ", %s heap holds %zu bytes idle", HALF_FIT_PER_CPU ? "per-CPU" : "per-thread cache", held );
+				}
+#endif
+				printf( "\n" );
+			}
+#else
+			printf( "%-18s skipped, needs HALF_FIT_THREAD_SAFE=1\n", label );
+#endif
+			continue;
+		}
+
+		n = ( w == 0 ) ? gen_fifo( ops, n_ops, live ) : ( w == 1 ) ? gen_lifo( ops, n_ops, live ) : gen_random( ops, n_ops, live );
+		for ( k = 0; k < sizeof(allocators) / sizeof(allocators[0]); ++k ) {
+			run_script( &allocators[k], ops, n, slots, &r );
+			print_result( label, allocators[k].name, &r );
+		}
+	}
+	return 0;
+}
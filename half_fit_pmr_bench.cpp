@@ -0,0 +1,135 @@
+/*
+	Benchmark of standard containers on a Half-Fit arena against the standard memory resources.
+
+	    gcc -O2 -c half_fit.c && g++ -std=c++17 -O2 -o half_fit_pmr_bench half_fit_pmr_bench.cpp half_fit.o
+	    ./half_fit_pmr_bench [rounds]
+
+	Each workload runs 'rounds' times (default 2000) on a fresh container:
+
+	    vector     push_back of 'elements' ints into a std::pmr::vector, which reallocates as it doubles
+	    map        insert 'elements' keys into a std::pmr::unordered_map, then erase them one by one
+	    map churn  keep 'elements' keys in the map while erasing the oldest and inserting a new one
+
+	against these resources:
+
+	    new_delete   std::pmr::new_delete_resource(), the C library's malloc underneath
+	    monotonic    std::pmr::monotonic_buffer_resource on a buffer 16 times the arena, released after every
+	                 round: it never frees, so it is the floor for allocation cost, but needs memory for everything
+	                 a round ever allocated
+	    half_fit     half_fit_resource on an arena
+
+	plus the plain std::vector / std::unordered_map with HalfFitAllocator, which skips the virtual calls of the
+	pmr interface. The element count is sized to the arena: 32 KiB with the default header, 64 MiB with the wide one.
+*/
+#include "half_fit_resource.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#if HALF_FIT_WIDE_HEADER
+#define ARENA_SIZE			( (size_t)64 << 20 )
+#define ELEMENTS			100000
+#else
+#define ARENA_SIZE			( (size_t)HALF_FIT_MAX_UNITS << 5 )
+#define ELEMENTS			300
+#endif
+
+static double now_ns( void ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+static half_fit_t arena;
+static unsigned rounds = 2000;
+
+template <typename Vector>
+static void vector_round( Vector &v ) {
+	for ( int i = 0; i < ELEMENTS; ++i ) v.push_back( i );
+}
+
+template <typename Map>
+static void map_round( Map &m ) {
+	for ( int i = 0; i < ELEMENTS; ++i ) m.emplace( i, i );
+	for ( int i = 0; i < ELEMENTS; ++i ) m.erase( i );
+}
+
+template <typename Map>
+static void churn_round( Map &m ) {
+	for ( int i = 0; i < ELEMENTS; ++i ) m.emplace( i, i );
+	for ( int i = ELEMENTS; i < 4 * ELEMENTS; ++i ) {
+		m.erase( i - ELEMENTS );
+		m.emplace( i, i );
+	}
+}
+
+// Times 'rounds' calls of 'round'; 'after' runs untimed after each one
+static void run( const char *workload, const char *name, unsigned ops_per_round,
+				 const std::function<void( void )> &round, const std::function<void( void )> &after ) {
+	double total = 0, t0;
+
+	for ( unsigned r = 0; r < rounds; ++r ) {
+		t0 = now_ns();
+		round();
+		total += now_ns() - t0;
+		after();
+	}
+	printf( "%-10s %-22s %8.1f ns/op\n", workload, name, total / ( (double)rounds * ops_per_round ) );
+}
+
+int main( int argc, char **argv ) {
+	static char region[ARENA_SIZE + 64];
+	std::vector<char> buffer( 16 * ARENA_SIZE );
+	std::pmr::monotonic_buffer_resource monotonic( buffer.data(), buffer.size(), std::pmr::null_memory_resource() );
+	half_fit_resource half_fit( &arena );
+	HalfFitAllocator<int> allocator( &arena );
+	std::pmr::memory_resource *resources[] = { std::pmr::new_delete_resource(), &monotonic, &half_fit };
+	const char *names[] = { "new_delete", "monotonic", "half_fit" };
+	std::function<void( void )> nothing = [] {};
+	std::function<void( void )> release = [&] { monotonic.release(); };
+
+	if ( argc > 1 ) rounds = (unsigned)strtoul( argv[1], NULL, 0 );
+	if ( half_init_arena( &arena, region, sizeof( region ) ) != 0 ) return 1;
+	printf( "%u rounds of %d elements, arena of %zu bytes\n\n", rounds, ELEMENTS, (size_t)arena.size << 5 );
+
+	for ( int k = 0; k < 3; ++k ) {
+		run( "vector", names[k], ELEMENTS, [&] {
+			std::pmr::vector<int> v( resources[k] );
+			vector_round( v );
+		}, k == 1 ? release : nothing );
+	}
+	run( "vector", "HalfFitAllocator", ELEMENTS, [&] {
+		std::vector<int, HalfFitAllocator<int> > v( allocator );
+		vector_round( v );
+	}, nothing );
+
+	for ( int k = 0; k < 3; ++k ) {
+		run( "map", names[k], 2 * ELEMENTS, [&] {
+			std::pmr::unordered_map<int, int> m( resources[k] );
+			map_round( m );
+		}, k == 1 ? release : nothing );
+	}
+	run( "map", "HalfFitAllocator", 2 * ELEMENTS, [&] {
+		std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, HalfFitAllocator<std::pair<const int, int> > > m( allocator );
+		map_round( m );
+	}, nothing );
+
+	// Four times more nodes go through the map than it ever holds
+	for ( int k = 0; k < 3; ++k ) {
+		run( "map churn", names[k], 4 * ELEMENTS, [&] {
+			std::pmr::unordered_map<int, int> m( resources[k] );
+			churn_round( m );
+		}, k == 1 ? release : nothing );
+	}
+	run( "map churn", "HalfFitAllocator", 4 * ELEMENTS, [&] {
+		std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, HalfFitAllocator<std::pair<const int, int> > > m( allocator );
+		churn_round( m );
+	}, nothing );
+
+	return 0;
+}
@@ -0,0 +1,245 @@
+/*
+	A malloc replacement on top of the Half-Fit default heap, so unmodified programs can run on the allocator:
+
+	    gcc -O2 -fPIC -shared -fvisibility=hidden -DHALF_FIT_GROW=1 -DHALF_FIT_WIDE_HEADER=1 -DHALF_FIT_ALIGN_16=1 \
+	        -o libhalf_fit.so half_fit_preload.c half_fit.c -lpthread
+	    LD_PRELOAD=./libhalf_fit.so program ...
+
+	It exports malloc, free, calloc, realloc, reallocarray, posix_memalign, aligned_alloc, memalign, valloc, pvalloc
+	and malloc_usable_size; everything else of the engine stays hidden. The heap grows in chunks (4 MiB with the
+	wide header), requests no chunk can hold get a mapping of their own that is unmapped again by free, and empty
+	chunks are unmapped once they pass the trim threshold. Memory is 16 byte aligned, as malloc's must be on the
+	usual 64-bit targets, so the build needs HALF_FIT_ALIGN_16.
+
+	half_init is never called. The default heap then starts out with no memory of its own and takes everything from
+	chunks, and that state is all zeros, so there is nothing to set up: calls made before any constructor has run,
+	by the loader or by other libraries' constructors, work like any other. Every call takes one lock. A call that
+	comes back in on a thread that is already inside the allocator, which only a signal handler that allocates can
+	do, must not wait for that lock; it is served from a static buffer instead, without any lock, and that memory is
+	never reused. The lock is held across fork, so the child gets a consistent heap.
+
+	Sizes of 4 GiB or more fail with ENOMEM, since the engine's sizes are 32 bit.
+*/
+#define _GNU_SOURCE
+#include "half_fit.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#if !HALF_FIT_GROW || !HALF_FIT_ALIGN_16
+#error "half_fit_preload.c needs HALF_FIT_GROW=1 and HALF_FIT_ALIGN_16=1"
+#endif
+#if HALF_FIT_TRACE
+#error "half_fit_preload.c cannot trace: the trace file itself is opened with malloc"
+#endif
+
+#define EXPORT				__attribute__( ( visibility( "default" ) ) )
+#define MALLOC_ALIGN		16
+#define BOOT_BYTES			( (size_t)1 << 20 )
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+// initial-exec TLS is part of the static TLS block, so reading it never allocates
+static __thread unsigned depth __attribute__( ( tls_model( "initial-exec" ) ) );
+
+/**----------------------------------------------------------Boot buffer--------------------------------------------------------------*/
+
+// Re-entered calls bump a pointer through this buffer; each block is preceded by its size
+static char boot_buffer[BOOT_BYTES] __attribute__( ( aligned( 64 ) ) );
+static size_t boot_used;
+
+static __inline int in_boot( void *mem ) {
+	return (char *)mem >= boot_buffer && (char *)mem < boot_buffer + BOOT_BYTES;
+}
+
+static void *boot_alloc( size_t alignment, size_t n ) {
+	size_t used = __atomic_load_n( &boot_used, __ATOMIC_RELAXED );
+	size_t start;
+
+	do {
+		start = ( used + sizeof( size_t ) + alignment - 1 ) & ~( alignment - 1 );
+		if ( start > BOOT_BYTES || n > BOOT_BYTES - start ) return NULL;
+	} while ( !__atomic_compare_exchange_n( &boot_used, &used, start + n, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) );
+
+	*(size_t *)( boot_buffer + start - sizeof( size_t ) ) = n;
+	return boot_buffer + start;
+}
+
+static __inline size_t boot_size( void *mem ) {
+	return *(size_t *)( (char *)mem - sizeof( size_t ) );
+}
+
+/**-------------------------------------------------------------Locking---------------------------------------------------------------*/
+
+// Returns 0 when the calling thread is already inside the allocator; leave() must follow either way
+static __inline int enter( void ) {
+	if ( depth++ != 0 ) return 0;
+	pthread_mutex_lock( &heap_lock );
+	return 1;
+}
+
+static __inline void leave( int locked ) {
+	if ( locked ) pthread_mutex_unlock( &heap_lock );
+	depth--;
+}
+
+static void fork_prepare( void ) {
+	pthread_mutex_lock( &heap_lock );
+}
+
+static void fork_parent( void ) {
+	pthread_mutex_unlock( &heap_lock );
+}
+
+static void fork_child( void ) {
+	pthread_mutex_init( &heap_lock, NULL );
+}
+
+__attribute__( ( constructor ) ) static void preload_init( void ) {
+	pthread_atfork( fork_prepare, fork_parent, fork_child );
+}
+
+/**-----------------------------------------------------------Allocation--------------------------------------------------------------*/
+
+// alignment is a power of two
+static void *take( size_t alignment, size_t n ) {
+	void *mem = NULL;
+	int locked;
+
+	if ( alignment < MALLOC_ALIGN ) alignment = MALLOC_ALIGN;
+	if ( n <= UINT32_MAX && alignment <= UINT32_MAX ) {
+		locked = enter();
+		if ( !locked ) {
+			mem = boot_alloc( alignment, n );
+		} else if ( alignment <= HALF_FIT_MIN_ALIGN ) {
+			mem = half_alloc( (U32)n );
+		} else {
+			mem = half_aligned_alloc( (U32)alignment, (U32)n );
+		}
+		leave( locked );
+	}
+	if ( mem == NULL ) errno = ENOMEM;
+	return mem;
+}
+
+static __inline int power_of_two( size_t x ) {
+	return x != 0 && ( x & ( x - 1 ) ) == 0;
+}
+
+EXPORT void *malloc( size_t n ) {
+	return take( MALLOC_ALIGN, n );
+}
+
+EXPORT void free( void *mem ) {
+	int locked;
+
+	if ( mem == NULL || in_boot( mem ) ) return;
+	locked = enter();
+	if ( locked ) half_free( (char *)mem );
+	leave( locked ); // a free that re-entered leaks the block rather than touch the heap under its owner's feet
+}
+
+EXPORT void *calloc( size_t count, size_t size ) {
+	void *mem = NULL;
+	int locked;
+
+	if ( size != 0 && count > SIZE_MAX / size ) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if ( count * size <= UINT32_MAX ) {
+		locked = enter();
+		// half_calloc clears only what is not known to be zero; the boot buffer is never reused, so it is all zero
+		mem = locked ? half_calloc( 1, (U32)( count * size ) ) : boot_alloc( MALLOC_ALIGN, count * size );
+		leave( locked );
+	}
+	if ( mem == NULL ) errno = ENOMEM;
+	return mem;
+}
+
+EXPORT void *realloc( void *mem, size_t n ) {
+	void *new_mem = NULL;
+	size_t old_bytes;
+	int locked;
+
+	if ( mem == NULL ) return take( MALLOC_ALIGN, n );
+	if ( in_boot( mem ) ) {
+		old_bytes = boot_size( mem );
+		new_mem = take( MALLOC_ALIGN, n );
+		if ( new_mem != NULL ) memcpy( new_mem, mem, ( old_bytes < n ) ? old_bytes : n );
+		return new_mem;
+	}
+	if ( n > UINT32_MAX ) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	locked = enter();
+	if ( locked ) {
+		new_mem = half_realloc( (char *)mem, (U32)n ); // a size of 0 frees, as glibc's does
+	} else if ( n != 0 && ( new_mem = boot_alloc( MALLOC_ALIGN, n ) ) != NULL ) {
+		// the block cannot grow in place without the lock, but its size can still be read
+		old_bytes = half_usable_size( (char *)mem );
+		memcpy( new_mem, mem, ( old_bytes < n ) ? old_bytes : n );
+	}
+	leave( locked );
+	if ( new_mem == NULL && n != 0 ) errno = ENOMEM;
+	return new_mem;
+}
+
+EXPORT void *reallocarray( void *mem, size_t count, size_t size ) {
+	if ( size != 0 && count > SIZE_MAX / size ) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return realloc( mem, count * size );
+}
+
+EXPORT int posix_memalign( void **out, size_t alignment, size_t n ) {
+	void *mem;
+
+	if ( !power_of_two( alignment ) || alignment % sizeof( void * ) != 0 ) return EINVAL;
+	mem = take( alignment, n );
+	if ( mem == NULL ) return ENOMEM;
+	*out = mem;
+	return 0;
+}
+
+EXPORT void *aligned_alloc( size_t alignment, size_t n ) {
+	if ( !power_of_two( alignment ) ) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return take( alignment, n );
+}
+
+EXPORT void *memalign( size_t alignment, size_t n ) {
+	return aligned_alloc( alignment, n );
+}
+
+EXPORT void *valloc( size_t n ) {
+	return take( (size_t)sysconf( _SC_PAGESIZE ), n );
+}
+
+EXPORT void *pvalloc( size_t n ) {
+	size_t page = (size_t)sysconf( _SC_PAGESIZE );
+
+	if ( n > SIZE_MAX - page ) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return take( page, ( n + page - 1 ) & ~( page - 1 ) );
+}
+
+EXPORT size_t malloc_usable_size( void *mem ) {
+	size_t bytes;
+	int locked;
+
+	if ( mem == NULL ) return 0;
+	if ( in_boot( mem ) ) return boot_size( mem );
+	locked = enter();
+	bytes = half_usable_size( (char *)mem );
+	leave( locked );
+	return bytes;
+}
@@ -0,0 +1,114 @@
+/*
+	Runs a program with the C library's malloc and with half_fit_preload.c's, and compares the two:
+
+	    gcc -O2 -o half_fit_preload_bench half_fit_preload_bench.c
+	    ./half_fit_preload_bench [-r runs] ./libhalf_fit.so program [arguments...]
+
+	The two take turns, 'runs' times each (default 5), so that a machine getting busier hurts both alike. For each
+	it prints the median wall clock time, the median user and system CPU time and the median peak RSS of the runs,
+	all taken from wait4 and so covering the program's children too when it waits for them. A run that does not
+	exit with status 0 is reported and ends the benchmark. For a load generator in front of a server, start the
+	server under LD_PRELOAD by hand and run the load generator here instead.
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_RUNS			101
+
+typedef struct {
+	double wall[MAX_RUNS];
+	double user[MAX_RUNS];
+	double sys[MAX_RUNS];
+	double rss_mib[MAX_RUNS];
+} results_t;
+
+static double now_s( void ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static double seconds( struct timeval tv ) {
+	return (double)tv.tv_sec + (double)tv.tv_usec * 1e-6;
+}
+
+static int compare( const void *a, const void *b ) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return ( x > y ) - ( x < y );
+}
+
+static double median( double *values, int n ) {
+	qsort( values, (size_t)n, sizeof( double ), compare );
+	return ( n & 1 ) ? values[n / 2] : ( values[n / 2 - 1] + values[n / 2] ) / 2;
+}
+
+// Runs the program once, with 'preload' in LD_PRELOAD unless it is NULL; returns 0 if it exited with status 0
+static int run( char **argv, const char *preload, results_t *results, int i ) {
+	struct rusage usage;
+	double t0 = now_s();
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if ( pid < 0 ) return -1;
+	if ( pid == 0 ) {
+		if ( preload != NULL ) setenv( "LD_PRELOAD", preload, 1 );
+		else unsetenv( "LD_PRELOAD" );
+		execvp( argv[0], argv );
+		_exit( 127 );
+	}
+	if ( wait4( pid, &status, 0, &usage ) != pid ) return -1;
+
+	results->wall[i] = now_s() - t0;
+	results->user[i] = seconds( usage.ru_utime );
+	results->sys[i] = seconds( usage.ru_stime );
+	results->rss_mib[i] = (double)usage.ru_maxrss / 1024; // ru_maxrss is in KiB on Linux
+	if ( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) {
+		fprintf( stderr, "%s run %d of %s failed with status %d\n", preload ? "half_fit" : "libc", i + 1, argv[0], status );
+		return -1;
+	}
+	return 0;
+}
+
+static void report( const char *name, results_t *results, int runs ) {
+	printf( "%-10s %9.3f s %9.3f s %9.3f s %10.1f MiB\n", name, median( results->wall, runs ),
+			median( results->user, runs ), median( results->sys, runs ), median( results->rss_mib, runs ) );
+}
+
+int main( int argc, char **argv ) {
+	static results_t libc, half_fit;
+	char library[4096];
+	int runs = 5, arg = 1, i;
+
+	if ( argc > 2 && strcmp( argv[1], "-r" ) == 0 ) {
+		runs = atoi( argv[2] );
+		arg = 3;
+	}
+	if ( argc - arg < 2 || runs < 1 || runs > MAX_RUNS ) {
+		fprintf( stderr, "usage: %s [-r runs] library program [arguments...]\n", argv[0] );
+		return 2;
+	}
+	// the program may change directory, so the library is given to it by its full path
+	if ( realpath( argv[arg], library ) == NULL ) {
+		perror( argv[arg] );
+		return 2;
+	}
+
+	for ( i = 0; i < runs; ++i ) {
+		if ( run( argv + arg + 1, NULL, &libc, i ) != 0 || run( argv + arg + 1, library, &half_fit, i ) != 0 ) return 1;
+	}
+
+	printf( "%d runs each of %s\n\n", runs, argv[arg + 1] );
+	printf( "%-10s %11s %11s %11s %14s\n", "malloc", "wall", "user", "sys", "peak RSS" );
+	report( "libc", &libc, runs );
+	report( "half_fit", &half_fit, runs );
+	return 0;
+}
@@ -0,0 +1,404 @@
+/*
+	Replays a trace recorded with half_trace_start (build with HALF_FIT_TRACE=1) against a Half-Fit arena, so the same
+	workload can be run against any build of the allocator and compared.
+
+	    gcc -O2 -o half_fit_replay half_fit_replay.c half_fit.c
+	    ./half_fit_replay [-a arena_bytes] [-i interval] trace_file
+
+	The trace is mapped rather than read, and the part already replayed is dropped from memory as the replay moves
+	on, so traces much larger than RAM work. Calls are replayed single threaded in the order they took effect, with
+	every block identified by the address it had when the trace was recorded. Allocations that already failed
+	while recording are skipped, as are frees of blocks whose allocation failed during the replay.
+
+	Every 'interval' calls (default 100000) a line shows the state of the arena:
+
+	    live      bytes requested by the blocks that are allocated
+	    in_use    bytes of the arena that are not free, headers and padding included
+	    int_frag  1 - live / in_use, the share of the used memory that the caller never asked for
+	    ext_frag  1 - largest free block / free bytes, 0 when all free memory is in one piece
+
+	At the end it prints the peak in_use, the first allocation the arena could not serve, and the p50/p99/p99.9/max
+	latency of each kind of call. Latencies are measured with clock_gettime and include the cost of reading the
+	clock. The arena defaults to the largest the header format allows (32 KiB for the default header, 64 MiB for
+	the wide one). Built with HALF_FIT_STATS=1 it also prints the arena's final statistics as JSON.
+*/
+#define _GNU_SOURCE
+#include "half_fit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if HALF_FIT_WIDE_HEADER
+#define ARENA_SIZE			( (size_t)64 << 20 )
+#else
+#define ARENA_SIZE			( (size_t)HALF_FIT_MAX_UNITS << 5 )
+#endif
+
+#define DROP_WINDOW			( (size_t)16 << 20 )	// replayed bytes of the trace dropped from memory at a time
+
+static uint64_t now_ns( void ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+/**-----------------------------------------------------------Live blocks-------------------------------------------------------------*/
+
+// Open addressing with linear probing from the traced address to the replayed block; id 0 marks an empty slot
+typedef struct {
+	uint64_t id;
+	char *mem;
+	U32 size;
+} live_t;
+
+static live_t *live;
+static size_t live_mask;
+static size_t live_count;
+static uint64_t live_bytes;
+
+static size_t live_slot( uint64_t id ) {
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdull;
+	id ^= id >> 33;
+	return (size_t)id & live_mask;
+}
+
+static void live_put( uint64_t id, char *mem, U32 size );
+
+static void live_grow( void ) {
+	live_t *old = live;
+	size_t old_len = live_mask + 1, i;
+
+	live_mask = old_len * 2 - 1;
+	live = calloc( live_mask + 1, sizeof( live_t ) );
+	if ( live == NULL ) {
+		fprintf( stderr, "out of memory\n" );
+		exit( 1 );
+	}
+	live_count = 0;
+	live_bytes = 0;
+	for ( i = 0; i < old_len; ++i ) {
+		if ( old[i].id != 0 ) {
+			live_put( old[i].id, old[i].mem, old[i].size );
+		}
+	}
+	free( old );
+}
+
+static void live_put( uint64_t id, char *mem, U32 size ) {
+	size_t i;
+
+	if ( ( live_count + 1 ) * 2 > live_mask + 1 ) {
+		live_grow();
+	}
+	for ( i = live_slot( id ); live[i].id != 0 && live[i].id != id; i = ( i + 1 ) & live_mask ) {
+	}
+	if ( live[i].id == 0 ) {
+		++live_count;
+	} else {
+		live_bytes -= live[i].size;	// the trace reused an address we still hold: the old block is lost
+	}
+	live[i].id = id;
+	live[i].mem = mem;
+	live[i].size = size;
+	live_bytes += size;
+}
+
+// Removes the block traced as 'id' and returns its memory, NULL if there is none
+static char *live_take( uint64_t id ) {
+	size_t i, j, home;
+	char *mem;
+
+	for ( i = live_slot( id ); live[i].id != id; i = ( i + 1 ) & live_mask ) {
+		if ( live[i].id == 0 ) {
+			return NULL;
+		}
+	}
+	mem = live[i].mem;
+	live_bytes -= live[i].size;
+	--live_count;
+
+	// shift the rest of the probe sequence back so no tombstones are needed
+	for ( j = ( i + 1 ) & live_mask; live[j].id != 0; j = ( j + 1 ) & live_mask ) {
+		home = live_slot( live[j].id );
+		if ( ( ( j - home ) & live_mask ) >= ( ( j - i ) & live_mask ) ) {
+			live[i] = live[j];
+			i = j;
+		}
+	}
+	live[i].id = 0;
+	return mem;
+}
+
+/**------------------------------------------------------------Latencies--------------------------------------------------------------*/
+
+// Log-linear histogram: exact below 64 ns, then 16 buckets per power of two (within 6.25%)
+#define HIST_BUCKETS		( 64 + 58 * 16 )
+
+typedef struct {
+	const char *name;
+	uint64_t count;
+	uint64_t max;
+	uint64_t hist[HIST_BUCKETS];
+} latency_t;
+
+enum { KIND_ALLOC, KIND_ALIGNED, KIND_FREE, KIND_REALLOC, KINDS };
+
+static latency_t latency[KINDS] = {
+	{ "alloc", 0, 0, { 0 } }, { "aligned", 0, 0, { 0 } }, { "free", 0, 0, { 0 } }, { "realloc", 0, 0, { 0 } }
+};
+
+static void record_latency( int kind, uint64_t ns ) {
+	latency_t *l = &latency[kind];
+	U32 e;
+
+	if ( ns < 64 ) {
+		++l->hist[ns];
+	} else {
+		e = 63 - (U32)__builtin_clzll( ns );
+		++l->hist[64 + ( e - 6 ) * 16 + ( ( ns >> ( e - 4 ) ) & 15 )];
+	}
+	++l->count;
+	if ( ns > l->max ) {
+		l->max = ns;
+	}
+}
+
+// Lower bound of the bucket holding the p-th percentile
+static uint64_t percentile( const latency_t *l, double p ) {
+	uint64_t rank = (uint64_t)( p * (double)( l->count - 1 ) ), seen = 0;
+	U32 b, e;
+
+	for ( b = 0; b < HIST_BUCKETS; ++b ) {
+		seen += l->hist[b];
+		if ( seen > rank ) {
+			break;
+		}
+	}
+	if ( b < 64 ) {
+		return b;
+	}
+	e = 6 + ( b - 64 ) / 16;
+	return ( (uint64_t)1 << e ) + ( (uint64_t)( ( b - 64 ) % 16 ) << ( e - 4 ) );
+}
+
+/**--------------------------------------------------------------Replay---------------------------------------------------------------*/
+
+static half_fit_t arena;
+static size_t arena_bytes;
+static size_t peak_in_use;
+static uint64_t failed_in_trace, failed, unmatched;
+static int first_failure_seen;
+
+static size_t in_use( void ) {
+	return arena_bytes - half_free_bytes( &arena );
+}
+
+static void print_state( uint64_t calls ) {
+	size_t used = in_use(), free_bytes = half_free_bytes( &arena );
+
+	printf( "%12llu %12llu %12zu %9.3f %9.3f\n", (unsigned long long)calls, (unsigned long long)live_bytes, used,
+		used == 0 ? 0.0 : 1.0 - (double)live_bytes / (double)used,
+		free_bytes == 0 ? 0.0 : 1.0 - (double)half_largest_free( &arena ) / (double)free_bytes );
+}
+
+static void allocation_failed( uint64_t record, U32 size, U32 alignment ) {
+	++failed;
+	if ( !first_failure_seen ) {
+		first_failure_seen = 1;
+		printf( "first failure: record %llu, %u bytes aligned to %u, with %llu bytes live, %zu in use, %zu free, "
+			"largest free block %zu\n", (unsigned long long)record, size, alignment, (unsigned long long)live_bytes,
+			in_use(), half_free_bytes( &arena ), half_largest_free( &arena ) );
+	}
+}
+
+static void usage( const char *prog ) {
+	fprintf( stderr, "usage: %s [-a arena_bytes] [-i interval] trace_file\n", prog );
+	exit( 2 );
+}
+
+int main( int argc, char **argv ) {
+	const half_trace_header_t *header;
+	const half_trace_record_t *records, *r;
+	uint64_t interval = 100000, calls = 0, t0;
+	size_t n, i, dropped = 0, page = (size_t)sysconf( _SC_PAGESIZE );
+	struct stat st;
+	char *map, *region, *mem, *old;
+	U32 alignment;
+	int fd, k, opt;
+
+	arena_bytes = ARENA_SIZE;
+	while ( ( opt = getopt( argc, argv, "a:i:" ) ) != -1 ) {
+		switch ( opt ) {
+			case 'a': arena_bytes = strtoull( optarg, NULL, 0 ); break;
+			case 'i': interval = strtoull( optarg, NULL, 0 ); break;
+			default: usage( argv[0] );
+		}
+	}
+	if ( optind + 1 != argc || interval == 0 ) {
+		usage( argv[0] );
+	}
+
+	fd = open( argv[optind], O_RDONLY );
+	if ( fd < 0 || fstat( fd, &st ) != 0 ) {
+		perror( argv[optind] );
+		return 1;
+	}
+	if ( (size_t)st.st_size < sizeof( half_trace_header_t ) ) {
+		fprintf( stderr, "%s: not a trace\n", argv[optind] );
+		return 1;
+	}
+	map = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	if ( map == MAP_FAILED ) {
+		perror( "mmap" );
+		return 1;
+	}
+	madvise( map, (size_t)st.st_size, MADV_SEQUENTIAL );
+	header = (const half_trace_header_t *)map;
+	if ( memcmp( header->magic, HALF_TRACE_MAGIC, sizeof( header->magic ) ) != 0
+		|| header->record_size != sizeof( half_trace_record_t ) ) {
+		fprintf( stderr, "%s: not a trace, or written by a host with another record layout\n", argv[optind] );
+		return 1;
+	}
+	records = (const half_trace_record_t *)( map + sizeof( half_trace_header_t ) );
+	n = ( (size_t)st.st_size - sizeof( half_trace_header_t ) ) / sizeof( half_trace_record_t );
+
+	region = malloc( arena_bytes );
+	if ( region == NULL || half_init_arena( &arena, region, arena_bytes ) != 0 ) {
+		fprintf( stderr, "cannot set up an arena of %zu bytes\n", arena_bytes );
+		return 1;
+	}
+	arena_bytes = (size_t)arena.size << 5;
+	live_mask = 1023;
+	live = calloc( live_mask + 1, sizeof( live_t ) );
+
+	printf( "%zu records, arena of %zu bytes\n", n, arena_bytes );
+	printf( "%12s %12s %12s %9s %9s\n", "calls", "live", "in_use", "int_frag", "ext_frag" );
+	for ( i = 0; i < n; ++i ) {
+		r = &records[i];
+		switch ( r->op & 0xFF ) {
+			case HALF_TRACE_ALLOC:
+				alignment = ( r->op >> 8 ) & 0xFF;
+				if ( r->id == 0 ) {
+					++failed_in_trace;
+					continue;
+				}
+				if ( r->op >> 8 ) {
+					alignment = 1u << alignment;
+					t0 = now_ns();
+					mem = half_aligned_alloc_from( &arena, alignment, r->size );
+					record_latency( KIND_ALIGNED, now_ns() - t0 );
+				} else {
+					alignment = 0;
+					t0 = now_ns();
+					mem = half_alloc_from( &arena, r->size );
+					record_latency( KIND_ALLOC, now_ns() - t0 );
+				}
+				if ( mem == NULL ) {
+					allocation_failed( i, r->size, alignment );
+				} else {
+					live_put( r->id, mem, r->size );
+				}
+				break;
+
+			case HALF_TRACE_FREE:
+				mem = live_take( r->id );
+				if ( mem == NULL ) {
+					++unmatched;
+					continue;
+				}
+				t0 = now_ns();
+				half_free_to( &arena, mem );
+				record_latency( KIND_FREE, now_ns() - t0 );
+				break;
+
+			case HALF_TRACE_REALLOC:
+				if ( i + 1 == n || ( records[i + 1].op & 0xFF ) != HALF_TRACE_REALLOC_TO ) {
+					++unmatched;	// cut off at the end of a trace that was never stopped
+					continue;
+				}
+				old = ( r->id == 0 ) ? NULL : live_take( r->id );
+				if ( r->id != 0 && old == NULL ) {
+					++unmatched;
+				}
+				++i;
+				if ( records[i].id == 0 && r->size != 0 ) {
+					++failed_in_trace;	// the block stayed where it was
+					if ( old != NULL ) {
+						live_put( r->id, old, r->size );
+					}
+					break;
+				}
+				t0 = now_ns();
+				mem = half_realloc_from( &arena, old, r->size );
+				record_latency( KIND_REALLOC, now_ns() - t0 );
+				if ( mem != NULL ) {
+					live_put( records[i].id, mem, r->size );
+				} else if ( r->size != 0 ) {
+					allocation_failed( i - 1, r->size, 0 );
+					if ( old != NULL ) {
+						live_put( records[i].id, old, r->size );	// keep the old block under its new name
+					}
+				}
+				break;
+
+			default:
+				fprintf( stderr, "record %zu: unknown op %u\n", i, r->op );
+				return 1;
+		}
+
+		if ( in_use() > peak_in_use ) {
+			peak_in_use = in_use();
+		}
+		if ( ++calls % interval == 0 ) {
+			print_state( calls );
+		}
+
+		// the replayed part of the trace is not needed any more
+		if ( ( (size_t)( (const char *)r - map ) & ~( page - 1 ) ) >= dropped + DROP_WINDOW ) {
+			madvise( map + dropped, DROP_WINDOW, MADV_DONTNEED );
+			dropped += DROP_WINDOW;
+		}
+	}
+	print_state( calls );
+
+	printf( "\npeak in_use %zu bytes (%.1f%% of the arena)\n", peak_in_use, 100.0 * (double)peak_in_use / (double)arena_bytes );
+	printf( "failed allocations: %llu during the replay, %llu already in the trace; %llu frees of unknown blocks\n",
+		(unsigned long long)failed, (unsigned long long)failed_in_trace, (unsigned long long)unmatched );
+	if ( n != 0 ) {
+		printf( "trace covers %.3f s\n", (double)records[n - 1].time / 1e9 );
+	}
+
+	printf( "\n%-8s %12s %10s %10s %10s %10s\n", "call", "count", "p50 ns", "p99 ns", "p99.9 ns", "max ns" );
+	for ( k = 0; k < KINDS; ++k ) {
+		if ( latency[k].count != 0 ) {
+			printf( "%-8s %12llu %10llu %10llu %10llu %10llu\n", latency[k].name, (unsigned long long)latency[k].count,
+				(unsigned long long)percentile( &latency[k], 0.5 ), (unsigned long long)percentile( &latency[k], 0.99 ),
+				(unsigned long long)percentile( &latency[k], 0.999 ), (unsigned long long)latency[k].max );
+		}
+	}
+
+#if HALF_FIT_STATS
+	{
+		half_stats_t stats;
+		char json[2048];
+
+		half_get_stats_from( &arena, &stats );
+		half_stats_json( &stats, json, sizeof( json ) );
+		printf( "\n%s\n", json );
+	}
+#endif
+
+	munmap( map, (size_t)st.st_size );
+	close( fd );
+	free( region );
+	free( live );
+	return 0;
+}
@@ -0,0 +1,126 @@
+#ifndef HALF_FIT_RESOURCE_HPP_
+#define HALF_FIT_RESOURCE_HPP_
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "half_fit.h"
+
+/*
+    C++17 adapters that let containers allocate from the C allocator without touching their call sites:
+
+      half_fit_resource    a std::pmr::memory_resource, for std::pmr containers and anything else taking one
+      HalfFitAllocator<T>  a standard allocator, for containers with an allocator template parameter
+
+    Both work on an explicit arena, or on the default heap when given none (half_init must have run). Alignments up
+    to HALF_FIT_MIN_ALIGN come from half_alloc(_from), larger ones up to HALF_FIT_MAX_ALIGN from
+    half_aligned_alloc(_from). Deallocation is always told the size, so plainly aligned memory goes back through
+    half_free_sized(_to), which finds the header without reading the slab map or the alignment pad. Failures throw
+    std::bad_alloc, as the standard requires.
+
+    An arena has no lock, so a resource or allocator on one inherits its rule: one thread at a time.
+*/
+namespace half_fit_detail {
+
+inline void *allocate(half_fit_t *arena, std::size_t bytes, std::size_t alignment)
+{
+    char *mem;
+
+    if(bytes > std::numeric_limits<U32>::max() || alignment > HALF_FIT_MAX_ALIGN){
+        throw std::bad_alloc();
+    }
+    if(alignment <= HALF_FIT_MIN_ALIGN){
+        mem = (arena == nullptr) ? half_alloc((U32)bytes) : half_alloc_from(arena, (U32)bytes);
+    } else {
+        mem = (arena == nullptr) ? half_aligned_alloc((U32)alignment, (U32)bytes)
+                                 : half_aligned_alloc_from(arena, (U32)alignment, (U32)bytes);
+    }
+    if(mem == nullptr){
+        throw std::bad_alloc();
+    }
+    return mem;
+}
+
+inline void deallocate(half_fit_t *arena, void *mem, std::size_t bytes, std::size_t alignment) noexcept
+{
+    if(alignment <= HALF_FIT_MIN_ALIGN){
+        if(arena == nullptr){
+            half_free_sized(static_cast<char *>(mem), (U32)bytes);
+        } else {
+            half_free_sized_to(arena, static_cast<char *>(mem), (U32)bytes);
+        }
+    } else if(arena == nullptr){
+        half_free(static_cast<char *>(mem));
+    } else {
+        half_free_to(arena, static_cast<char *>(mem));
+    }
+}
+
+} // namespace half_fit_detail
+
+class half_fit_resource : public std::pmr::memory_resource {
+public:
+    half_fit_resource() noexcept = default;
+    explicit half_fit_resource(half_fit_t *arena) noexcept : arena_(arena) {}
+
+    half_fit_t *arena() const noexcept { return arena_; }
+
+private:
+    half_fit_t *arena_ = nullptr;       // nullptr for the default heap
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return half_fit_detail::allocate(arena_, bytes, alignment);
+    }
+
+    void do_deallocate(void *mem, std::size_t bytes, std::size_t alignment) override
+    {
+        half_fit_detail::deallocate(arena_, mem, bytes, alignment);
+    }
+
+    // two resources can free each other's memory when they manage the same heap
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const half_fit_resource *resource = dynamic_cast<const half_fit_resource *>(&other);
+
+        return resource != nullptr && resource->arena_ == arena_;
+    }
+};
+
+template <typename T>
+class HalfFitAllocator {
+public:
+    using value_type = T;
+
+    HalfFitAllocator() noexcept = default;
+    explicit HalfFitAllocator(half_fit_t *arena) noexcept : arena_(arena) {}
+    template <typename U>
+    HalfFitAllocator(const HalfFitAllocator<U> &other) noexcept : arena_(other.arena()) {}
+
+    half_fit_t *arena() const noexcept { return arena_; }
+
+    T *allocate(std::size_t n)
+    {
+        if(n > std::numeric_limits<std::size_t>::max() / sizeof(T)){
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(half_fit_detail::allocate(arena_, n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *mem, std::size_t n) noexcept
+    {
+        half_fit_detail::deallocate(arena_, mem, n * sizeof(T), alignof(T));
+    }
+
+    template <typename U>
+    bool operator==(const HalfFitAllocator<U> &other) const noexcept { return arena_ == other.arena(); }
+    template <typename U>
+    bool operator!=(const HalfFitAllocator<U> &other) const noexcept { return arena_ != other.arena(); }
+
+private:
+    half_fit_t *arena_ = nullptr;       // nullptr for the default heap
+};
+
+#endif
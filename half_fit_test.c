@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define smlst_blk			5
 #define	smlst_blk_sz  ( 1 << smlst_blk )
@@ -14,6 +15,7 @@
 #define RNDM_TESTS	100
 
 /**-----------------------------------------------------------------Timer part--------------------------------------------------------*/
+#if defined(__CC_ARM)
 // How many ticks are passed
 volatile uint32_t msTicks;
 volatile uint8_t run_timer;
@@ -53,6 +55,50 @@ __inline TimerReset(){
 	}
 }
 
+#else
+// Hosted builds (Linux and friends) have no SysTick; the same interface runs off the monotonic clock
+#include <stdint.h>
+#include <time.h>
+
+static struct timespec timer_start;
+static uint32_t timer_elapsed;	// ms accumulated by earlier start/stop pairs
+static uint8_t run_timer;
+
+static uint32_t timer_ms_since_start( void ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint32_t)( ( now.tv_sec - timer_start.tv_sec ) * 1000 + ( now.tv_nsec - timer_start.tv_nsec ) / 1000000 );
+}
+
+static void TimerInit( void ) {
+	timer_elapsed = 0;
+	run_timer = 0;
+}
+
+static void TimerStart( void ) {
+	clock_gettime( CLOCK_MONOTONIC, &timer_start );
+	run_timer = 1;
+}
+
+static void TimerStop( void ) {
+	if ( run_timer ) {
+		timer_elapsed += timer_ms_since_start();
+	}
+	run_timer = 0;
+}
+
+static uint32_t current_elapsed_time( void ) {
+	return run_timer ? timer_elapsed + timer_ms_since_start() : timer_elapsed;
+}
+
+static void TimerReset( void ) {
+	if ( run_timer == 0 ) {
+		timer_elapsed = 0;
+	}
+}
+#endif
+
 /**--------------------------------------------------------------End of Timer part--------------------------------------------------------*/
 
 /*
@@ -162,7 +208,6 @@ bool test_max_alc( void ) {
 	half_init();
 
 	blk_sz = find_max_block();
-	printf("blk_sz = %d", blk_sz);
 	max_blk_sz = 0x01 << lrgst_blk;
 
 	if ( ((int)max_blk_sz - (int)blk_sz) / max_blk_sz > 1 ) {
@@ -448,6 +493,805 @@ bool test_max_alc_1_byte( void ) {
 	return rslt;
 }
 
+bool test_arenas( void ) {
+	static char mem_1[lrgst_blk_sz], mem_2[lrgst_blk_sz >> 2];
+	half_fit_t arena_1, arena_2;
+	char *ptr_1, *ptr_2;
+
+	if ( half_init_arena( &arena_1, mem_1, sizeof(mem_1) ) != 0 ) return false;
+	if ( half_init_arena( &arena_2, mem_2, sizeof(mem_2) ) != 0 ) return false;
+
+	// Each arena hands out memory from its own region only
+	ptr_1 = half_alloc_from( &arena_1, 1 << 13 );
+	ptr_2 = half_alloc_from( &arena_2, 1 << 12 );
+	if ( ptr_1 < mem_1 || ptr_1 >= mem_1 + sizeof(mem_1) ) return false;
+	if ( ptr_2 < mem_2 || ptr_2 >= mem_2 + sizeof(mem_2) ) return false;
+
+	// Filling one arena does not affect the other
+	if ( half_alloc_from( &arena_2, 1 << 13 ) != NULL ) return false;
+	if ( half_alloc_from( &arena_1, 1 << 13 ) == NULL ) return false;
+
+	half_free_to( &arena_2, ptr_2 );
+	if ( half_check_arena( &arena_1 ) != 0 || half_check_arena( &arena_2 ) != 0 ) return false;
+
+	// A reset gives the whole region back without freeing anything
+	half_reset_arena( &arena_1 );
+	ptr_1 = half_alloc_from( &arena_1, lrgst_blk_sz - HALF_FIT_HEADER_SIZE );
+
+	return ptr_1 != NULL && half_alloc_from( &arena_2, sizeof(mem_2) - HALF_FIT_HEADER_SIZE ) != NULL;
+}
+
+bool test_batch( void ) {
+	static char *ptrs[lrgst_blk_sz / smlst_blk_sz];
+	static block_t blks[lrgst_blk_sz / smlst_blk_sz];
+	uint32_t c, i;
+	size_t max_sz;
+
+	half_init();
+	max_sz = find_max_block();
+
+	// A batch that fits comes back whole and without overlaps
+	c = half_alloc_batch( 100, 64, ptrs );
+	if ( c != 64 ) return false;
+	for ( i = 0; i < c; ++i ) {
+		blks[i].ptr = ptrs[i];
+		blks[i].len = 100;
+	}
+	if ( is_violated( find_violation( blks, c ) ) ) return false;
+	half_free_batch( ptrs, c );
+
+	// A batch that does not fit gets as many blocks as the heap holds
+	c = half_alloc_batch( 1000, lrgst_blk_sz / smlst_blk_sz, ptrs );
+	if ( c == 0 || c > lrgst_blk_sz / 1000 ) return false;
+	half_free_batch( ptrs, c );
+
+	// Everything coalesced back into one block
+	ptrs[0] = half_alloc( max_sz );
+	if ( ptrs[0] == NULL ) return false;
+	half_free( ptrs[0] );
+	return true;
+}
+
+bool test_realloc( void ) {
+	char *ptr_1, *ptr_2, *ptr_3;
+	size_t max_sz;
+	uint32_t i;
+
+	half_init();
+	max_sz = find_max_block();
+
+	// Blocks above 512 bytes, so that thread safe builds do not keep them in a per-thread cache
+	ptr_1 = half_alloc(600);
+	ptr_2 = half_alloc(600);
+	if ( ptr_1 == NULL || ptr_2 == NULL ) return false;
+	for ( i = 0; i < 600; ++i ) ptr_1[i] = (char)i;
+
+	// Grows into the free block after it, then shrinks, without moving
+	half_free(ptr_2);
+	if ( half_realloc(ptr_1, 1200) != ptr_1 ) return false;
+	if ( half_realloc(ptr_1, 700) != ptr_1 ) return false;
+
+	// Blocked by an allocated neighbour, it moves and keeps its contents
+	ptr_2 = half_alloc(600);
+	ptr_3 = half_realloc(ptr_1, 3000);
+	if ( ptr_3 == NULL || ptr_3 == ptr_1 ) return false;
+	for ( i = 0; i < 600; ++i ) {
+		if ( ptr_3[i] != (char)i ) return false;
+	}
+
+	// No room leaves the block alone
+	if ( half_realloc(ptr_3, lrgst_blk_sz) != NULL ) return false;
+
+	half_free(ptr_2);
+	half_free(ptr_3);
+
+	ptr_1 = half_alloc( max_sz );
+	if ( ptr_1 == NULL ) return false;
+	half_free( ptr_1 );
+	return true;
+}
+
+bool test_aligned_alloc( void ) {
+	char *ptrs[13];
+	size_t max_sz;
+	uint32_t i, j;
+
+	half_init();
+	max_sz = find_max_block();
+
+	// Every power of two up to a page, each block filled to catch overlaps
+	for ( i = 0; i < 13; ++i ) {
+		ptrs[i] = half_aligned_alloc( 1 << i, 100 );
+		if ( ptrs[i] == NULL || ( (size_t)ptrs[i] & ( ( 1 << i ) - 1 ) ) != 0 ) return false;
+		for ( j = 0; j < 100; ++j ) ptrs[i][j] = (char)i;
+	}
+	for ( i = 0; i < 13; ++i ) {
+		for ( j = 0; j < 100; ++j ) {
+			if ( ptrs[i][j] != (char)i ) return false;
+		}
+	}
+	if ( half_aligned_alloc( 3, 100 ) != NULL || half_aligned_alloc( HALF_FIT_MAX_ALIGN << 1, 100 ) != NULL ) return false;
+
+	// An aligned block resizes in place like any other
+	if ( half_realloc( ptrs[12], 50 ) != ptrs[12] ) return false;
+
+	for ( i = 0; i < 13; ++i ) {
+		half_free( ptrs[i] );
+	}
+
+	// The slack in front of each block was given back, too
+	ptrs[0] = half_alloc( max_sz );
+	if ( ptrs[0] == NULL ) return false;
+	half_free( ptrs[0] );
+	return true;
+}
+
+#if HALF_FIT_SLAB
+bool test_slab_1_byte( void ) {
+	static char mem[lrgst_blk_sz];
+	static char *ptrs[lrgst_blk_sz / 8];
+	half_fit_t arena;
+	uint32_t c = 0, i;
+
+	if ( half_init_arena( &arena, mem, sizeof(mem) ) != 0 ) return false;
+
+	// Slots have no header, so 1-byte blocks pack denser than whole units
+	while ( c < lrgst_blk_sz / 8 && ( ptrs[c] = half_alloc_from( &arena, 1 ) ) != NULL ) {
+		*ptrs[c] = (char)c;
+		c++;
+	}
+	if ( c < 3 * ( lrgst_blk_sz / smlst_blk_sz ) / 2 ) {
+		printf( "Only %d 1-Byte blocks fit in slabs\n", c );
+		return false;
+	}
+
+	for ( i = 0; i < c; ++i ) {
+		if ( *ptrs[i] != (char)i ) return false;
+	}
+	for ( i = 0; i < c; ++i ) {
+		half_free_to( &arena, ptrs[i] );
+	}
+
+	// Emptied slabs go back to the heap once a big block needs them
+	return half_alloc_from( &arena, lrgst_blk_sz - HALF_FIT_HEADER_SIZE ) != NULL;
+}
+#endif
+
+#if HALF_FIT_SUB_BIN_BITS
+bool test_sub_bins( void ) {
+	static char mem[lrgst_blk_sz];
+	half_fit_t arena;
+	char *a, *b;
+
+	if ( half_init_arena( &arena, mem, sizeof(mem) ) != 0 ) return false;
+
+	// A free block of 48 units, kept apart from the rest of the arena
+	a = half_alloc_from( &arena, 48 * 32 - HALF_FIT_HEADER_SIZE );
+	if ( a == NULL || half_alloc_from( &arena, 100 ) == NULL ) return false;
+	half_free_to( &arena, a );
+
+	// Classic Half-Fit would serve 33 units from the 64 unit class and cut the big block; a sub-bin finds the small one
+	b = half_alloc_from( &arena, 33 * 32 - HALF_FIT_HEADER_SIZE );
+	return b == a && half_check_arena( &arena ) == 0;
+}
+
+#if HALF_FIT_WIDE_HEADER
+#include <sys/mman.h>
+
+// The bins after the last sub-bin of the top size class do not exist; a request just short of the biggest block
+// there is served from the head of its own bin
+bool test_sub_bins_top( void ) {
+	size_t len = (size_t)32 << 30;
+	char *out[32];
+	half_fit_t arena;
+	char *mem;
+	U32 filled;
+	bool ok;
+
+	// Only the headers are ever written, so the 32 GiB need not be backed
+	mem = (char *)mmap( NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+	if ( mem == MAP_FAILED ) return false;
+	ok = half_init_arena( &arena, mem, len ) == 0 && arena.size == HALF_FIT_MAX_UNITS;
+
+	// A batch is taken as one run: 31 blocks of 2^25 + 1 units are 2^30 - 2^25 + 31 units, in the last sub-bin of
+	// class 29 for every HALF_FIT_SUB_BIN_BITS, and not its smallest size
+	filled = ok ? half_alloc_batch_from( &arena, 1u << 30, 32, out ) : 0;
+	ok = ok && filled == 31 && half_check_arena( &arena ) == 0;
+	half_free_batch_to( &arena, out, filled );
+	ok = ok && half_check_arena( &arena ) == 0 && arena.free_units == arena.size;
+
+	munmap( mem, len );
+	return ok;
+}
+#endif
+#endif
+
+static bool all_zero( const char *mem, U32 n ) {
+	U32 i;
+
+	for ( i = 0; i < n; ++i ) {
+		if ( mem[i] != 0 ) return false;
+	}
+	return true;
+}
+
+bool test_calloc( void ) {
+	static char mem[lrgst_blk_sz];
+	half_fit_t arena;
+	char *a, *b, *c;
+
+	// Memory comes back zero whether the region was dirty to begin with or the block was used before
+	memset( mem, 0x5A, sizeof( mem ) );
+	if ( half_init_arena( &arena, mem, sizeof( mem ) ) != 0 ) return false;
+	a = half_calloc_from( &arena, 100, 10 );
+	c = half_calloc_from( &arena, 3, 8 );
+	if ( a == NULL || !all_zero( a, 1000 ) || c == NULL || !all_zero( c, 24 ) ) return false;
+	memset( a, 0x5A, 1000 );
+	memset( c, 0x5A, 24 );
+	half_free_to( &arena, a );
+	half_free_to( &arena, c );
+	b = half_calloc_from( &arena, 10, 100 );
+	c = half_calloc_from( &arena, 24, 1 );
+	if ( b == NULL || !all_zero( b, 1000 ) || c == NULL || !all_zero( c, 24 ) ) return false;
+
+	// A count * size past 32 bits fails instead of wrapping around
+	if ( half_calloc_from( &arena, 0x10000, 0x10001 ) != NULL || half_calloc( 0x10001, 0x10000 ) != NULL ) return false;
+	if ( half_check_arena( &arena ) != 0 ) return false;
+
+	// The default heap: a block split off a bigger one, then blocks over memory handed out before
+	half_init();
+	a = half_calloc( 1, 4000 );
+	if ( a == NULL || !all_zero( a, 4000 ) ) return false;
+	memset( a, 0x5A, 4000 );
+	b = half_calloc( 4000, 1 );
+	if ( b == NULL || !all_zero( b, 4000 ) ) return false;
+	memset( b, 0x5A, 4000 );
+	half_free( a );
+	half_free( b );
+	a = half_calloc( 2, 4000 );
+	if ( a == NULL || !all_zero( a, 8000 ) ) return false;
+	half_free( a );
+	return true;
+}
+
+#if HALF_FIT_TRACE
+bool test_trace( void ) {
+	const char *path = "half_fit_test.trace";
+	half_trace_header_t header;
+	half_trace_record_t rec[8];
+	char *a, *b, *c;
+	size_t n;
+	FILE *f;
+
+	half_init();
+	if ( half_trace_start( path ) != 0 ) return false;
+	a = half_alloc( 100 );
+	b = half_aligned_alloc( 64, 40 );
+	c = half_realloc( a, 700 );
+	half_free( b );
+	half_free( c );
+	half_trace_stop();
+
+	// Once stopped, nothing more is recorded
+	half_free( half_alloc( 10 ) );
+
+	f = fopen( path, "rb" );
+	if ( f == NULL ) return false;
+	n = fread( &header, sizeof( header ), 1, f );
+	n = ( n == 1 ) ? fread( rec, sizeof( rec[0] ), 8, f ) : 0;
+	fclose( f );
+	remove( path );
+
+	if ( n != 6 || memcmp( header.magic, HALF_TRACE_MAGIC, 8 ) != 0 || header.record_size != sizeof( rec[0] ) ) return false;
+	if ( rec[0].op != HALF_TRACE_ALLOC || rec[0].size != 100 || rec[0].id != (size_t)a ) return false;
+	if ( rec[1].op != ( HALF_TRACE_ALLOC | ( 6 << 8 ) ) || rec[1].size != 40 || rec[1].id != (size_t)b ) return false;
+	if ( rec[2].op != HALF_TRACE_REALLOC || rec[2].size != 700 || rec[2].id != (size_t)a ) return false;
+	if ( rec[3].op != HALF_TRACE_REALLOC_TO || rec[3].id != (size_t)c ) return false;
+	if ( rec[4].op != HALF_TRACE_FREE || rec[4].id != (size_t)b ) return false;
+	if ( rec[5].op != HALF_TRACE_FREE || rec[5].id != (size_t)c ) return false;
+	return rec[0].time <= rec[5].time;
+}
+#endif
+
+#if HALF_FIT_PROFILE
+// Counts the lines of a file and adds up the number that ends each one
+static int profile_lines( const char *path, unsigned long long *sum ) {
+	char line[4096];
+	char *last;
+	int lines = 0;
+	FILE *f = fopen( path, "r" );
+
+	if ( f == NULL ) return -1;
+	*sum = 0;
+	while ( fgets( line, sizeof( line ), f ) != NULL ) {
+		last = strrchr( line, ' ' );
+		*sum += ( last != NULL ) ? strtoull( last + 1, NULL, 10 ) : 0;
+		++lines;
+	}
+	fclose( f );
+	return lines;
+}
+
+bool test_profile( void ) {
+	const char *path = "half_fit_test.profile";
+	unsigned long long sum;
+	char line[256];
+	char *a, *b, *c, *d;
+	FILE *f;
+
+	// One byte between samples: every block is sampled
+	half_init();
+	half_profile_start( 1 );
+	a = half_alloc( 100 );
+	b = half_aligned_alloc( 64, 40 );
+	c = half_calloc( 10, 30 );
+	half_free( b );
+	a = half_realloc( a, 700 );
+	if ( a == NULL || c == NULL ) return false;
+
+	// At a rate of 1 a block's estimate is its size
+	if ( half_profile_dump( path, HALF_PROFILE_FOLDED ) != 0 ) return false;
+	if ( profile_lines( path, &sum ) != 2 || sum != 1000 ) return false;
+
+	if ( half_profile_dump( path, HALF_PROFILE_PPROF ) != 0 || ( f = fopen( path, "r" ) ) == NULL ) return false;
+	if ( fgets( line, sizeof( line ), f ) == NULL ) line[0] = '\0';
+	fclose( f );
+	if ( strcmp( line, "heap profile: 2: 1000 [2: 1000] @ heap_v2/1\n" ) != 0 ) return false;
+
+	// Once stopped nothing new is sampled, but frees still drop their samples
+	half_profile_stop();
+	d = half_alloc( 100 );
+	half_free( c );
+	if ( half_profile_dump( path, HALF_PROFILE_FOLDED ) != 0 ) return false;
+	if ( profile_lines( path, &sum ) != 1 || sum != 700 ) return false;
+	remove( path );
+	half_free( a );
+	half_free( d );
+	return true;
+}
+#endif
+
+#if HALF_FIT_STATS
+bool test_stats( void ) {
+	half_stats_t st;
+	char json[1024];
+	char *a, *b;
+	int len;
+
+	half_init();
+	half_get_stats( &st );
+	if ( st.in_use_bytes != 0 || st.free_blocks != 1 || st.largest_free != st.arena_bytes ) return false;
+	if ( st.splits != 0 || st.coalesces != 0 || st.failed_allocs != 0 || st.external_fragmentation != 0.0 ) return false;
+
+	// Blocks too big for the per-thread caches of thread safe builds, so they come straight from the bins
+	a = half_alloc( 1000 );
+	b = half_alloc( 1000 );
+	if ( a == NULL || b == NULL || half_alloc( st.arena_bytes ) != NULL ) return false;
+	half_free( a );
+	half_get_stats( &st );
+	if ( st.in_use_bytes != 1024 || st.high_water_bytes != 2048 || st.splits != 2 || st.failed_allocs != 1 ) return false;
+	if ( st.free_blocks != 2 || st.largest_free != st.arena_bytes - 2048 || st.external_fragmentation <= 0.0 ) return false;
+	if ( st.free_bytes_per_bin[5] != 1024 || st.free_blocks_per_bin[5] != 1 ) return false;
+
+	// b merges with both free neighbours
+	half_free( b );
+	half_get_stats( &st );
+	if ( st.coalesces != 2 || st.free_blocks != 1 || st.high_water_bytes != 2048 ) return false;
+
+	len = half_stats_json( &st, json, sizeof( json ) );
+	if ( len <= 0 || len >= (int)sizeof( json ) || strstr( json, "\"failed_allocs\":1," ) == NULL ) return false;
+	return half_stats_json( &st, json, 16 ) == len && json[15] == '\0';
+}
+#endif
+
+#if HALF_FIT_GROW
+bool test_grow( void ) {
+	char *ptrs[200];
+	char *big;
+	uint32_t i, j;
+
+	half_init();
+	half_set_trim_threshold( (size_t)-1 );
+
+	// Far more than the initial heap holds: the heap maps chunks to make room
+	for ( i = 0; i < 200; ++i ) {
+		ptrs[i] = half_alloc( 1000 );
+		if ( ptrs[i] == NULL ) return false;
+		memset( ptrs[i], (int)i, 1000 );
+	}
+
+	// Requests no chunk can hold get a mapping of their own, a realloc that outgrows its chunk included
+	big = half_alloc( 3 * HALF_FIT_CHUNK_SIZE );
+	if ( big == NULL ) return false;
+	memset( big, 1, 3 * HALF_FIT_CHUNK_SIZE );
+	ptrs[0] = half_realloc( ptrs[0], 2 * HALF_FIT_CHUNK_SIZE );
+	if ( ptrs[0] == NULL ) return false;
+	for ( i = 0; i < 200; ++i ) {
+		for ( j = 0; j < 1000; ++j ) {
+			if ( ptrs[i][j] != (char)i ) return false;
+		}
+	}
+	if ( half_usable_size( big ) < 3 * HALF_FIT_CHUNK_SIZE || half_usable_size( ptrs[1] ) < 1000 ) return false;
+	half_free( big );
+	half_free_batch( ptrs, 200 );
+
+	// Alignments past what an arena takes get a mapping of their own too
+	big = half_aligned_alloc( HALF_FIT_CHUNK_SIZE / 2, 100 );
+	if ( big == NULL || ( (size_t)big & ( HALF_FIT_CHUNK_SIZE / 2 - 1 ) ) != 0 || half_usable_size( big ) < 100 ) return false;
+	half_free( big );
+
+	// Every chunk is empty again, so trimming unmaps them, and the heap carries on as before
+	if ( half_trim() < HALF_FIT_CHUNK_SIZE ) return false;
+	ptrs[0] = half_alloc( 1000 );
+	if ( ptrs[0] == NULL ) return false;
+	half_free( ptrs[0] );
+
+	half_set_trim_threshold( HALF_FIT_TRIM_THRESHOLD );
+	return true;
+}
+#endif
+
+#if HALF_FIT_MAPPED
+#include <sys/wait.h>
+#include <unistd.h>
+
+bool test_mapped( void ) {
+	const char *path = "half_fit_test.heap";
+	half_fit_t *hf;
+	char *root, *ptrs[20];
+	uint32_t i, j;
+	uint32_t *list;	// offsets, which need only the word alignment every block has
+	FILE *f;
+	pid_t pid;
+	int status;
+
+	hf = half_init_mapped( path, 64 * 1024 );
+	if ( hf == NULL ) return false;
+
+	// A list of blocks whose root holds their offsets, with a hole or two between them
+	root = half_alloc_from( hf, 20 * sizeof( uint32_t ) );
+	if ( root == NULL ) return false;
+	list = (uint32_t *)root;
+	for ( i = 0; i < 20; ++i ) {
+		ptrs[i] = half_alloc_from( hf, 50 + 40 * i );
+		if ( ptrs[i] == NULL ) return false;
+		memset( ptrs[i], (int)i, 50 + 40 * i );
+		list[i] = (uint32_t)( ptrs[i] - hf->base_address );
+	}
+	half_free_to( hf, ptrs[3] );
+	half_free_to( hf, ptrs[11] );
+	list[3] = list[11] = 0;
+	half_set_root( hf, root );
+	if ( half_close_mapped( hf ) != 0 ) return false;
+
+	// Reopened, everything is where it was
+	hf = half_open_mapped( path );
+	if ( hf == NULL || half_check_arena( hf ) != 0 ) return false;
+	list = (uint32_t *)half_get_root( hf );
+	for ( i = 0; i < 20; ++i ) {
+		for ( j = 0; list[i] != 0 && j < 50 + 40 * i; ++j ) {
+			if ( hf->base_address[list[i] + j] != (char)i ) return false;
+		}
+	}
+
+	// A process that dies half way through with the heap open, its bins wrecked
+	fflush( stdout );
+	pid = fork();
+	if ( pid < 0 ) return false;
+	if ( pid == 0 ) {
+		half_free_to( hf, hf->base_address + list[5] );
+		half_alloc_from( hf, 3000 );
+		memset( hf->bin_heads, 0x55, sizeof( hf->bin_heads ) );
+		hf->free_units = 7;
+		_exit( 0 );
+	}
+	if ( waitpid( pid, &status, 0 ) != pid ) return false;
+
+	hf = half_open_mapped( path );
+	if ( hf == NULL || half_check_arena( hf ) != 0 ) return false;
+	list = (uint32_t *)half_get_root( hf );
+	for ( i = 0; i < 20; ++i ) {
+		for ( j = 0; i != 5 && list[i] != 0 && j < 50 + 40 * i; ++j ) {
+			if ( hf->base_address[list[i] + j] != (char)i ) return false;
+		}
+		if ( i != 5 && list[i] != 0 ) half_free_to( hf, hf->base_address + list[i] );
+	}
+	if ( half_alloc_from( hf, 8000 ) == NULL || half_close_mapped( hf ) != 0 ) return false;
+
+	// Files that are not heaps of this build are turned away
+	f = fopen( path, "r+b" );
+	if ( f == NULL ) return false;
+	fputs( "HFHEAP99", f );
+	fclose( f );
+	hf = half_open_mapped( path );
+	remove( path );
+	return hf == NULL && errno == EINVAL && half_open_mapped( path ) == NULL;
+}
+#endif
+
+#if HALF_FIT_SHARED
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+bool test_shared( void ) {
+	char name[64];
+	half_fit_t *hf, *view;
+	size_t handle;
+	char *msg;
+	uint32_t i, j;
+	int fd, pipe_fd[2], status;
+	pid_t pid;
+
+	snprintf( name, sizeof( name ), "/half_fit_test.%d", (int)getpid() );
+	fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+	if ( fd < 0 ) return false;
+	shm_unlink( name );
+	hf = half_init_shared( fd, 64 * 1024 );
+	if ( hf == NULL || pipe( pipe_fd ) != 0 ) return false;
+
+	// A producer attaches on its own, builds messages in place and passes on their handles only
+	fflush( stdout );
+	pid = fork();
+	if ( pid < 0 ) return false;
+	if ( pid == 0 ) {
+		view = half_attach_shared( fd );
+		if ( view == NULL ) _exit( 1 );
+		for ( i = 0; i < 50; ++i ) {
+			while ( ( msg = half_shared_alloc( view, 1000 + i ) ) == NULL ) usleep( 100 );
+			memset( msg, (int)i, 1000 + i );
+			handle = half_shared_handle( view, msg );
+			if ( write( pipe_fd[1], &handle, sizeof( handle ) ) != sizeof( handle ) ) _exit( 1 );
+		}
+		half_detach_shared( view );
+		_exit( 0 );
+	}
+	close( pipe_fd[1] );
+
+	// The consumer reads each message where the producer wrote it, in its own mapping, and frees it
+	for ( i = 0; i < 50; ++i ) {
+		if ( read( pipe_fd[0], &handle, sizeof( handle ) ) != sizeof( handle ) ) return false;
+		msg = half_shared_pointer( hf, handle );
+		if ( msg < (char *)hf || msg >= (char *)hf + 64 * 1024 ) return false;
+		for ( j = 0; j < 1000 + i; ++j ) {
+			if ( msg[j] != (char)i ) return false;
+		}
+		half_shared_free( hf, msg );
+	}
+	close( pipe_fd[0] );
+	if ( waitpid( pid, &status, 0 ) != pid || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ) return false;
+
+	// Everything came back, and something that is not a heap is turned away
+	msg = half_shared_alloc( hf, ( hf->size << 5 ) - HALF_FIT_HEADER_SIZE );
+	half_shared_free( hf, msg );
+	view = half_attach_shared( pipe_fd[0] );
+	half_detach_shared( hf );
+	close( fd );
+	return msg != NULL && view == NULL;
+}
+#endif
+
+#if HALF_FIT_THREAD_SAFE
+#include <pthread.h>
+
+static half_fit_t remote_arena;
+
+static void *remote_freer( void *arg ) {
+	char **ptrs = (char **)arg;
+	uint32_t i;
+
+	for ( i = 0; ptrs[i] != NULL; ++i ) {
+		half_free_to( &remote_arena, ptrs[i] );
+	}
+	return NULL;
+}
+
+// Blocks another thread frees into a claimed arena wait on its queue until the owner allocates again: a batch at
+// a time, and all of them once an allocation would fail without them
+bool test_remote_free( void ) {
+	static char mem[lrgst_blk_sz];
+	static char *ptrs[lrgst_blk_sz / 32 + 1];
+	pthread_t thread;
+	uint32_t count = 0, free_units, units;
+	char *a;
+
+	if ( half_init_arena( &remote_arena, mem, sizeof( mem ) ) != 0 ) return false;
+	half_claim_arena( &remote_arena );
+
+	// Fill the arena with blocks too big for a slab
+	while ( ( ptrs[count] = half_alloc_from( &remote_arena, 100 ) ) != NULL ) {
+		count++;
+	}
+	if ( count <= 2 * HALF_FIT_REMOTE_BATCH ) return false;
+	free_units = remote_arena.free_units;
+
+	if ( pthread_create( &thread, NULL, remote_freer, ptrs ) != 0 ) return false;
+	pthread_join( thread, NULL );
+	if ( remote_arena.free_units != free_units || remote_arena.remote_frees == NULL ) return false;
+
+	// One allocation takes back one batch and reuses one of its blocks
+	a = half_alloc_from( &remote_arena, 100 );
+	if ( a == NULL || remote_arena.remote_pending == NULL ) return false;
+	units = (uint32_t)( ( half_usable_size_from( &remote_arena, a ) + HALF_FIT_HEADER_SIZE ) >> 5 );
+	if ( remote_arena.free_units - free_units != ( HALF_FIT_REMOTE_BATCH - 1 ) * units ) return false;
+	half_free_to( &remote_arena, a );
+	if ( half_check_arena( &remote_arena ) != 0 ) return false;
+
+	// The whole arena only fits once the rest of the queue is taken back
+	a = half_alloc_from( &remote_arena, ( remote_arena.size << 5 ) - HALF_FIT_HEADER_SIZE );
+	if ( a == NULL || remote_arena.remote_pending != NULL || remote_arena.remote_frees != NULL ) return false;
+	half_free_to( &remote_arena, a );
+	return half_check_arena( &remote_arena ) == 0 && remote_arena.free_units == remote_arena.size;
+}
+#endif
+
+#if HALF_FIT_THREAD_SAFE && !HALF_FIT_PER_CPU
+#include <sched.h>
+
+#define SHARED_SLOTS		64
+#define SHARED_PRODUCERS	6
+#define SHARED_CONSUMERS	2
+#define SHARED_BLOCKS		3000	// per producer
+
+static char *shared_slots[SHARED_SLOTS];
+static uint32_t shared_producing;
+
+static bool shared_check_free( char *p ) {
+	uint32_t n, k;
+
+	memcpy( &n, p, sizeof( n ) );
+	for ( k = sizeof( n ); k < n; ++k ) {
+		if ( p[k] != (char)n ) return false;
+	}
+	half_free( p );
+	return true;
+}
+
+// Allocates blocks of one and two units, and now and then one too big to cache, and hands them over through the
+// slots; it never frees, so its caches keep running dry and being refilled
+static void *shared_producer( void *arg ) {
+	static const uint32_t sizes[4] = { 24, 56, 24, 1000 };
+	unsigned seed = (unsigned)(size_t)arg;
+	uint32_t i, n, tries, k;
+	char *p, *empty;
+
+	for ( i = 0; i < SHARED_BLOCKS; ++i ) {
+		n = sizes[( i % 64 == 63 ) ? 3 : rand_r( &seed ) % 3];
+		// The consumers' caches may hold the rest of the heap for a while
+		for ( tries = 0; ( p = half_alloc( n ) ) == NULL && tries < 1000; ++tries ) {
+			sched_yield();
+		}
+		if ( p == NULL ) continue;
+		memset( p, (char)n, n );
+		memcpy( p, &n, sizeof( n ) );
+		for ( k = rand_r( &seed ) % SHARED_SLOTS; ; k = ( k + 1 ) % SHARED_SLOTS ) {
+			empty = NULL;
+			if ( __atomic_compare_exchange_n( &shared_slots[k], &empty, p, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) ) break;
+			if ( k == SHARED_SLOTS - 1 ) sched_yield();
+		}
+		sched_yield();	// lets the consumers in even on a single CPU
+	}
+	__atomic_sub_fetch( &shared_producing, 1, __ATOMIC_RELEASE );
+	return NULL;
+}
+
+// Frees what the producers hand over; it never allocates, so its caches keep growing past HALF_FIT_CACHE_LIMIT and
+// being flushed
+static void *shared_consumer( void *arg ) {
+	bool found, done;
+	uint32_t k;
+	char *p;
+
+	do {
+		done = __atomic_load_n( &shared_producing, __ATOMIC_ACQUIRE ) == 0;
+		found = false;
+		for ( k = 0; k < SHARED_SLOTS; ++k ) {
+			p = __atomic_exchange_n( &shared_slots[k], NULL, __ATOMIC_ACQUIRE );
+			if ( p != NULL ) {
+				if ( !shared_check_free( p ) ) return arg;
+				found = true;
+			}
+		}
+		if ( !found ) sched_yield();
+	} while ( found || !done );
+	return NULL;
+}
+
+// Threads allocating and freeing each other's blocks through their caches leave the heap whole once they exit and
+// their caches are flushed
+bool test_threads( void ) {
+	pthread_t threads[SHARED_PRODUCERS + SHARED_CONSUMERS];
+	size_t max_blk, i;
+	void *rslt, *failed = NULL;
+
+	half_init();
+	max_blk = find_max_block();
+
+	shared_producing = SHARED_PRODUCERS;
+	for ( i = 0; i < SHARED_PRODUCERS + SHARED_CONSUMERS; ++i ) {
+		if ( pthread_create( &threads[i], NULL, ( i < SHARED_PRODUCERS ) ? shared_producer : shared_consumer,
+							 (void *)( i + 1 ) ) != 0 ) return false;
+	}
+	for ( i = 0; i < SHARED_PRODUCERS + SHARED_CONSUMERS; ++i ) {
+		pthread_join( threads[i], &rslt );
+		failed = ( rslt != NULL ) ? rslt : failed;
+	}
+	for ( i = 0; i < SHARED_SLOTS; ++i ) {
+		if ( shared_slots[i] != NULL ) return false;
+	}
+
+	return failed == NULL && find_max_block() == max_blk;
+}
+#endif
+
+#if HALF_FIT_PER_CPU
+#include <pthread.h>
+
+// Blocks of the largest size the heap hands out that can be allocated at once: one per arena when they are all whole
+static uint32_t count_max_blocks( void ) {
+	static char *ptrs[HALF_FIT_CPU_ARENAS + 1];
+	size_t max_blk = find_max_block();
+	uint32_t count = 0;
+
+	while ( count <= HALF_FIT_CPU_ARENAS && ( ptrs[count] = half_alloc( max_blk ) ) != NULL ) {
+		count++;
+	}
+	half_free_batch( ptrs, count );
+	return count;
+}
+
+static void *per_cpu_worker( void *arg ) {
+	unsigned seed = (unsigned)(size_t)arg;
+	char *ptrs[32] = { 0 };
+	uint32_t sizes[32] = { 0 };
+	uint32_t i, j, k;
+
+	for ( j = 0; j < 20000; ++j ) {
+		i = rand_r( &seed ) % 32;
+		if ( ptrs[i] != NULL ) {
+			for ( k = 0; k < sizes[i]; ++k ) {
+				if ( ptrs[i][k] != (char)( i + (size_t)arg ) ) return arg;
+			}
+			half_free( ptrs[i] );
+			ptrs[i] = NULL;
+			continue;
+		}
+		sizes[i] = rand_r( &seed ) % 300 + 1;
+		ptrs[i] = ( j % 4 == 0 ) ? half_aligned_alloc( 64, sizes[i] ) : half_alloc( sizes[i] );
+		if ( ptrs[i] != NULL ) {
+			memset( ptrs[i], (int)( i + (size_t)arg ), sizes[i] );
+		}
+	}
+	half_free_batch( ptrs, 32 );
+	return NULL;
+}
+
+// Threads churning on the per-CPU arenas at once leave every arena whole again
+bool test_per_cpu( void ) {
+	pthread_t threads[8];
+	uint32_t arenas;
+	size_t i;
+	void *failed = NULL;
+
+	half_init();
+	arenas = count_max_blocks();
+	if ( arenas == 0 ) return false;
+
+	for ( i = 0; i < 8; ++i ) {
+		pthread_create( &threads[i], NULL, per_cpu_worker, (void *)( i + 1 ) );
+	}
+	for ( i = 0; i < 8; ++i ) {
+		void *rslt;
+
+		pthread_join( threads[i], &rslt );
+		failed = ( rslt != NULL ) ? rslt : failed;
+	}
+
+	return failed == NULL && count_max_blocks() == arenas;
+}
+#endif
+
 bool test_max_alc_rand_byte( void ) {
 
 	return false;
@@ -456,11 +1300,15 @@ bool test_max_alc_rand_byte( void ) {
 
 int main( void ) {
 
+#if defined(__CC_ARM)
 	SystemInit();
 	SystemCoreClockUpdate();
+#endif
 	TimerInit();
 
 	TimerStart(); {
+#if !HALF_FIT_GROW
+		// These fill the heap up, which a growable heap never lets happen
 		printf( "test_max_alc=%i \n",                   test_max_alc() );
 
 		printf( "test_alc_free_max=%i \n",              test_alc_free_max() );
@@ -468,9 +1316,59 @@ int main( void ) {
 		printf( "test_static_alc_free_violation=%i \n", test_static_alc_free_violation() );
 		printf( "test_rndm_alc_free=%i \n",             test_rndm_alc_free() );
 		printf( "test_max_alc_1_byte=%i \n",            test_max_alc_1_byte() );
+#endif
+		printf( "test_arenas=%i \n",                    test_arenas() );
+#if !HALF_FIT_GROW
+#if !HALF_FIT_PER_CPU
+		// The heap is a single arena here, or a batch too big for it would still fit
+		printf( "test_batch=%i \n",                     test_batch() );
+#endif
+		printf( "test_realloc=%i \n",                   test_realloc() );
+		printf( "test_aligned_alloc=%i \n",             test_aligned_alloc() );
+#else
+		printf( "test_grow=%i \n",                      test_grow() );
+#endif
+#if HALF_FIT_MAPPED
+		printf( "test_mapped=%i \n",                    test_mapped() );
+#endif
+#if HALF_FIT_SHARED
+		printf( "test_shared=%i \n",                    test_shared() );
+#endif
+#if HALF_FIT_THREAD_SAFE
+		printf( "test_remote_free=%i \n",               test_remote_free() );
+#endif
+#if HALF_FIT_THREAD_SAFE && !HALF_FIT_PER_CPU
+		printf( "test_threads=%i \n",                   test_threads() );
+#endif
+#if HALF_FIT_PER_CPU
+		printf( "test_per_cpu=%i \n",                   test_per_cpu() );
+#endif
+#if HALF_FIT_SUB_BIN_BITS
+		printf( "test_sub_bins=%i \n",                  test_sub_bins() );
+#if HALF_FIT_WIDE_HEADER
+		printf( "test_sub_bins_top=%i \n",              test_sub_bins_top() );
+#endif
+#endif
+#if HALF_FIT_SLAB
+		printf( "test_slab_1_byte=%i \n",               test_slab_1_byte() );
+#endif
+		printf( "test_calloc=%i \n",                    test_calloc() );
+#if HALF_FIT_TRACE
+		printf( "test_trace=%i \n",                     test_trace() );
+#endif
+#if HALF_FIT_PROFILE
+		printf( "test_profile=%i \n",                   test_profile() );
+#endif
+#if HALF_FIT_STATS && !HALF_FIT_GROW && !HALF_FIT_PER_CPU
+		printf( "test_stats=%i \n",                     test_stats() );
+#endif
 	} TimerStop();
 
 	printf( "The elappsed time is %d ms\n", current_elapsed_time() );
 
+#if defined(__CC_ARM)
 	while(1);
+#else
+	return 0;
+#endif
 }
@@ -0,0 +1,131 @@
+/*
+	Tests for the C++ template in half_fit.hpp and the adapters in half_fit_resource.hpp, built against the C
+	allocator:
+
+	    gcc -c half_fit.c && g++ -std=c++17 -o half_fit_test_cpp half_fit_test.cpp half_fit.o
+*/
+#include "half_fit.hpp"
+#include "half_fit.h"
+#include "half_fit_resource.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory_resource>
+#include <vector>
+
+// The geometry is all compile time constants
+static_assert( HalfFit<>::kBins == 11 && HalfFit<>::kUnit == 32 && HalfFit<>::kMaxUnits == 1024, "default geometry" );
+static_assert( sizeof( HalfFit<>::Word ) == 4 && HalfFit<>::kHeaderBytes == 4, "default header" );
+static_assert( HalfFit<>::units_for( 28 ) == 1 && HalfFit<>::units_for( 29 ) == 2, "header included in the units" );
+static_assert( HalfFit<>::bin_of( 1023 ) == 9 && HalfFit<>::fit_bin( 513 ) == 10, "bin math" );
+static_assert( sizeof( HalfFit<4, 24, 8>::Word ) == 8 && HalfFit<4, 24, 8>::kBins == 21, "wide geometry" );
+
+alignas( 64 ) static char c_region[32768];
+alignas( 64 ) static char cpp_region[32768];
+
+// The default instantiation places every block where the C allocator's default arena does
+bool test_same_placement( void ) {
+	static half_fit_t c_arena;
+	static HalfFit<> cpp_arena;
+	char *c_ptrs[64] = { 0 };
+	char *cpp_ptrs[64] = { 0 };
+	unsigned i, j, n;
+
+	if ( half_init_arena( &c_arena, c_region, sizeof( c_region ) ) != 0 || !cpp_arena.init( cpp_region, sizeof( cpp_region ) ) ) return false;
+	srand( 7 );
+	for ( j = 0; j < 100000; ++j ) {
+		i = rand() % 64;
+		if ( c_ptrs[i] != NULL ) {
+			half_free_to( &c_arena, c_ptrs[i] );
+			cpp_arena.deallocate( cpp_ptrs[i] );
+			c_ptrs[i] = cpp_ptrs[i] = NULL;
+		} else if ( rand() % 4 == 0 && j != 0 ) {
+			n = rand() % 2000 + 1;
+			i = ( i + 1 ) % 64;
+			c_ptrs[i] = half_realloc_from( &c_arena, c_ptrs[i], n ) ;
+			cpp_ptrs[i] = (char *)cpp_arena.reallocate( cpp_ptrs[i], n );
+		} else {
+			n = rand() % 2000 + 1;
+			c_ptrs[i] = half_alloc_from( &c_arena, n );
+			cpp_ptrs[i] = (char *)cpp_arena.allocate( n );
+		}
+		if ( ( c_ptrs[i] == NULL ) != ( cpp_ptrs[i] == NULL ) ) return false;
+		if ( c_ptrs[i] != NULL && c_ptrs[i] - c_arena.base_address != cpp_ptrs[i] - cpp_region ) return false;
+		if ( half_free_bytes( &c_arena ) != cpp_arena.free_bytes() ) return false;
+	}
+	return half_largest_free( &c_arena ) == cpp_arena.largest_free();
+}
+
+// A geometry of its own: 4 KiB blocks, 16 byte aligned memory
+bool test_small_geometry( void ) {
+	typedef HalfFit<5, 12, 16> Arena;
+	static Arena arena;
+	void *ptrs[Arena::kMaxUnits + 1];
+	unsigned count = 0, i;
+
+	arena.init( cpp_region + 3, Arena::kMaxBlock + 100 );
+	if ( arena.capacity() != Arena::kMaxBlock ) return false;
+
+	// 16 byte headers still leave room for a 1 byte request in a single unit
+	while ( count <= Arena::kMaxUnits && ( ptrs[count] = arena.allocate( 1 ) ) != NULL ) {
+		if ( ( (size_t)ptrs[count] & 15 ) != 0 ) return false;
+		++count;
+	}
+	if ( count != Arena::kMaxUnits ) return false;
+	for ( i = 0; i < count; i += 2 ) arena.deallocate( ptrs[i] );
+	for ( i = 1; i < count; i += 2 ) arena.deallocate( ptrs[i] );
+
+	// Everything coalesced back into one block
+	return arena.largest_free() == Arena::kMaxBlock && arena.allocate( Arena::kMaxBlock - 16 ) != NULL;
+}
+
+// Containers on an arena through the pmr resource and the allocator, all of it given back when they go
+bool test_resource( void ) {
+	static half_fit_t arena;
+	half_fit_resource resource( &arena );
+	HalfFitAllocator<int> allocator( &arena );
+	U32 full;
+	void *mem;
+	bool threw = false;
+
+	if ( half_init_arena( &arena, c_region, sizeof( c_region ) ) != 0 ) return false;
+	full = half_free_bytes( &arena );
+	{
+		std::pmr::vector<int> v( &resource );
+		std::pmr::map<int, int> m( &resource );
+		std::vector<int, HalfFitAllocator<int> > w( allocator );
+
+		for ( int i = 0; i < 200; ++i ) {
+			v.push_back( i );
+			m[i] = i;
+			w.push_back( i );
+		}
+		for ( int i = 0; i < 200; i += 2 ) m.erase( i );
+		if ( v[199] != 199 || m.size() != 100 || w[199] != 199 ) return false;
+		if ( (char *)v.data() < c_region || (char *)v.data() >= c_region + sizeof( c_region ) ) return false;
+		if ( half_free_bytes( &arena ) >= full ) return false;
+	}
+	if ( half_free_bytes( &arena ) != full ) return false;
+
+	// Over aligned requests go through half_aligned_alloc_from
+	mem = resource.allocate( 100, 256 );
+	if ( ( (size_t)mem & 255 ) != 0 ) return false;
+	resource.deallocate( mem, 100, 256 );
+
+	// Running out throws instead of returning NULL
+	try {
+		mem = resource.allocate( sizeof( c_region ) );
+	} catch ( const std::bad_alloc & ) {
+		threw = true;
+	}
+
+	return threw && half_free_bytes( &arena ) == full && resource.is_equal( half_fit_resource( &arena ) ) &&
+		   !resource.is_equal( half_fit_resource() ) && allocator == HalfFitAllocator<long>( &arena );
+}
+
+int main( void ) {
+	printf( "test_same_placement=%i \n", test_same_placement() );
+	printf( "test_small_geometry=%i \n", test_small_geometry() );
+	printf( "test_resource=%i \n", test_resource() );
+	return 0;
+}
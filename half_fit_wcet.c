@@ -0,0 +1,297 @@
+/*
+	Worst-case execution time checks for hosted (Linux) builds: puts arenas of several sizes into the states that
+	make Half-Fit work hardest, times single operations on them, and fails if any costs more than a bound or gets
+	slower as the arena grows, which is what a loop over blocks or bins would do.
+
+	    gcc -O2 -o half_fit_wcet half_fit_wcet.c half_fit.c -lpthread
+	    ./half_fit_wcet [-c cpu] [-r repeats] [-b bound] [-g growth] [-s slack]
+
+	The states, each built on arenas from 4 to 32 KiB with the default header and from 64 KiB to 64 MiB with the
+	wide one, out of blocks of 2 units (bigger than a slab slot, so slab builds take the same paths):
+
+	    alloc_fragmented  every other block free: the most free blocks the arena can have, all in one bin list;
+	                      allocate one
+	    alloc_miss        the same state; ask for 3 units, which no free block has, so the bitmap scan comes up empty
+	                      and the fallback check of the bin below fails too
+	    alloc_all_bins    a free block in every size class, 2^i units each, kept apart by allocated blocks; ask for
+	                      one unit less than the largest, which misses the bitmap, takes the fallback and splits
+	    free_isolated     every block allocated; free one, nothing to merge
+	    free_coalesce     free, allocated, free, allocated...; free an allocated one, which merges with both sides
+
+	Operations are timed one at a time with the processor's cycle counter (rdtsc on x86, clock_gettime elsewhere),
+	less the cost of reading it, on a thread pinned to one CPU ('cpu', by default the one it starts on). Memory the
+	operation will touch is brought into the cache first, by running it once untimed and undoing it, or by reading
+	the blocks around it, so the times reflect the code path rather than the memory hierarchy. Each state is built
+	'repeats' times (default 5) and each of its 256 operations keeps its fastest time, which filters out interrupts
+	and other noise that hit a single run; the worst of those is the operation's WCET estimate.
+
+	The run fails, exiting with status 1, if an estimate exceeds 'bound' ticks (default 0, no bound), or if the
+	estimate on the largest arena exceeds 'growth' (default 2) times the one on the smallest plus 'slack' ticks
+	(default 100).
+*/
+#define _GNU_SOURCE
+#include "half_fit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define UNIT				32
+#define INSTANCES			256
+#define SIZES				4
+
+#if HALF_FIT_WIDE_HEADER
+static const size_t arena_sizes[SIZES] = { (size_t)64 << 10, (size_t)1 << 20, (size_t)16 << 20, (size_t)64 << 20 };
+#else
+static const size_t arena_sizes[SIZES] = { (size_t)4 << 10, (size_t)8 << 10, (size_t)16 << 10, (size_t)32 << 10 };
+#endif
+
+/**-----------------------------------------------------------------Clock--------------------------------------------------------------*/
+
+#if defined(__x86_64__) || defined(__i386__)
+static __inline uint64_t ticks( void ) {
+	_mm_lfence();	// keep the read from drifting into the measured operation
+	return __rdtsc();
+}
+#else
+static __inline uint64_t ticks( void ) {
+	struct timespec now;
+
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+#endif
+
+static uint64_t overhead;	// ticks of two back to back reads
+
+static void measure_overhead( void ) {
+	uint64_t t0, t1;
+	int i;
+
+	overhead = UINT64_MAX;
+	for ( i = 0; i < 10000; ++i ) {
+		t0 = ticks();
+		t1 = ticks();
+		if ( t1 - t0 < overhead ) overhead = t1 - t0;
+	}
+}
+
+/**-----------------------------------------------------------------States-------------------------------------------------------------*/
+
+static half_fit_t arena;
+static char *region;
+static char **blocks;			// the blocks of 2 units that fill the arena, in address order
+static size_t n_blocks;
+static uint32_t small_n;		// bytes of a 2 unit block
+static uint32_t top_units;		// size of the largest free block of alloc_all_bins
+static volatile char sink;
+
+static uint32_t bytes_for( uint32_t units ) {
+	return units * UNIT - HALF_FIT_HEADER_SIZE;
+}
+
+static void fill( size_t size ) {
+	char *p;
+
+	half_init_arena( &arena, region, size );
+	n_blocks = 0;
+	while ( ( p = half_alloc_from( &arena, small_n ) ) != NULL ) blocks[n_blocks++] = p;
+}
+
+static void build_fragmented( size_t size ) {
+	size_t i;
+
+	fill( size );
+	for ( i = 1; i < n_blocks; i += 2 ) half_free_to( &arena, blocks[i] );
+}
+
+static void build_all_bins( size_t size ) {
+	char *p;
+	uint32_t c;
+
+	half_init_arena( &arena, region, size );
+	n_blocks = 0;
+	for ( c = 0; c < 31; ++c ) {
+		p = half_alloc_from( &arena, bytes_for( 1u << c ) );
+		if ( p == NULL ) break;
+		if ( half_alloc_from( &arena, small_n ) == NULL ) {
+			half_free_to( &arena, p );
+			break;
+		}
+		blocks[n_blocks++] = p;
+	}
+	top_units = 1u << ( n_blocks - 1 );
+	while ( n_blocks != 0 ) half_free_to( &arena, blocks[--n_blocks] );
+}
+
+// The timed operations take the block of the instance, if any, and return what an undo needs
+static char *alloc_small( char *p )		{ (void)p; return half_alloc_from( &arena, small_n ); }
+static char *alloc_three( char *p )		{ (void)p; return half_alloc_from( &arena, bytes_for( 3 ) ); }
+static char *alloc_top( char *p )		{ (void)p; return half_alloc_from( &arena, bytes_for( top_units - 1 ) ); }
+static char *release( char *p )			{ half_free_to( &arena, p ); return NULL; }
+
+static void undo_alloc( char *p, char *r )	{ (void)p; half_free_to( &arena, r ); }
+static void undo_free( char *p, char *r )	{ (void)r; if ( half_alloc_from( &arena, small_n ) != p ) abort(); }
+
+typedef struct scenario {
+	const char *name;
+	void  (*build)( size_t );
+	char *(*op)( char * );
+	void  (*undo)( char *, char * );	// puts the state back, NULL if it has to be built again
+	size_t first, step;					// instances free blocks[first], blocks[first + step]... but the last one; step 0
+										// for instances that take no block
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+	{ "alloc_fragmented", build_fragmented, alloc_small, undo_alloc, 0, 0 },
+	{ "alloc_miss",       build_fragmented, alloc_three, undo_alloc, 0, 0 },
+	{ "alloc_all_bins",   build_all_bins,   alloc_top,   undo_alloc, 0, 0 },
+	{ "free_isolated",    fill,             release,     undo_free,  1, 1 },
+	{ "free_coalesce",    build_fragmented, release,     NULL,       2, 4 },
+};
+#define SCENARIOS			( sizeof( scenarios ) / sizeof( scenarios[0] ) )
+
+/**-----------------------------------------------------------------Measurement--------------------------------------------------------*/
+
+// Reads the headers and links of the blocks around blocks[k] and the heads of the bins
+static void touch( size_t k ) {
+	size_t i, bin;
+
+	for ( i = ( k < 4 ) ? 0 : k - 4; i <= k + 4 && i < n_blocks; ++i ) {
+		sink = blocks[i][-1];
+		sink = blocks[i][0];
+	}
+	for ( bin = 0; bin < sizeof( arena.bin_heads ) / sizeof( arena.bin_heads[0] ); ++bin ) {
+		if ( arena.bin_heads[bin] < arena.size ) sink = arena.base_address[(size_t)arena.bin_heads[bin] * UNIT];
+	}
+}
+
+// Runs one scenario on an arena of 'size' bytes; returns the worst over its instances of their fastest time
+static uint64_t run( const scenario_t *s, size_t size, unsigned repeats ) {
+	static uint64_t best[INSTANCES];
+	size_t count = 0, total, j, k = 0;
+	uint64_t t0, t1, worst = 0;
+	unsigned rep;
+	char *p = NULL, *r;
+
+	for ( j = 0; j < INSTANCES; ++j ) best[j] = UINT64_MAX;
+	for ( rep = 0; rep < repeats; ++rep ) {
+		s->build( size );
+		total = ( s->step == 0 ) ? INSTANCES : ( n_blocks > s->first + 1 ) ? ( n_blocks - s->first - 2 ) / s->step + 1 : 0;
+		count = ( total < INSTANCES ) ? total : INSTANCES;
+		for ( j = 0; j < count; ++j ) {
+			if ( s->step != 0 ) {
+				k = s->first + j * total / count * s->step;	// spread over the whole arena
+				p = blocks[k];
+			}
+			if ( s->undo != NULL ) {
+				s->undo( p, s->op( p ) );
+			} else if ( j == 0 ) {
+				// the first store after a build waits for the build's dirty lines to be written back
+				s->op( p );
+				best[j] = 0;
+				continue;
+			} else {
+				touch( k );
+			}
+			t0 = ticks();
+			r = s->op( p );
+			t1 = ticks();
+			if ( s->undo != NULL ) s->undo( p, r );
+			t1 = ( t1 - t0 > overhead ) ? t1 - t0 - overhead : 0;
+			if ( t1 < best[j] ) best[j] = t1;
+		}
+	}
+	for ( j = 0; j < count; ++j ) {
+		if ( best[j] > worst ) worst = best[j];
+	}
+	return worst;
+}
+
+int main( int argc, char **argv ) {
+	static uint64_t wcet[SCENARIOS][SIZES];
+	unsigned repeats = 5;
+	uint64_t bound = 0, slack = 100;
+	double growth = 2.0;
+	cpu_set_t cpus;
+	int cpu = -1, failed = 0, opt;
+	size_t s, z;
+
+	while ( ( opt = getopt( argc, argv, "c:r:b:g:s:" ) ) != -1 ) {
+		switch ( opt ) {
+		case 'c': cpu = atoi( optarg ); break;
+		case 'r': repeats = (unsigned)strtoul( optarg, NULL, 0 ); break;
+		case 'b': bound = strtoull( optarg, NULL, 0 ); break;
+		case 'g': growth = atof( optarg ); break;
+		case 's': slack = strtoull( optarg, NULL, 0 ); break;
+		default:
+			fprintf( stderr, "usage: %s [-c cpu] [-r repeats] [-b bound] [-g growth] [-s slack]\n", argv[0] );
+			return 2;
+		}
+	}
+	if ( repeats == 0 ) {
+		fprintf( stderr, "need at least one repeat\n" );
+		return 2;
+	}
+
+	// Migrations and page faults would be measured along with the allocator
+	if ( cpu < 0 ) cpu = sched_getcpu();
+	CPU_ZERO( &cpus );
+	CPU_SET( cpu, &cpus );
+	if ( sched_setaffinity( 0, sizeof( cpus ), &cpus ) != 0 ) {
+		perror( "sched_setaffinity" );
+		return 2;
+	}
+	mlockall( MCL_CURRENT | MCL_FUTURE );	// best effort, it needs privileges
+
+	small_n = bytes_for( 2 );
+	region = (char *)malloc( arena_sizes[SIZES - 1] );
+	blocks = (char **)malloc( arena_sizes[SIZES - 1] / ( 2 * UNIT ) * sizeof( char * ) );
+	if ( region == NULL || blocks == NULL ) {
+		fprintf( stderr, "out of memory\n" );
+		return 1;
+	}
+	memset( region, 0, arena_sizes[SIZES - 1] );
+	measure_overhead();
+
+	printf( "ticks per operation, worst of %d instances, each the fastest of %u runs; pinned to CPU %d\n\n",
+			INSTANCES, repeats, cpu );
+	printf( "%-18s", "scenario" );
+	for ( z = 0; z < SIZES; ++z ) printf( " %8zu KiB", arena_sizes[z] >> 10 );
+	printf( " %8s\n", "growth" );
+	for ( s = 0; s < SCENARIOS; ++s ) {
+		printf( "%-18s", scenarios[s].name );
+		for ( z = 0; z < SIZES; ++z ) {
+			wcet[s][z] = run( &scenarios[s], arena_sizes[z], repeats );
+			printf( " %12llu", (unsigned long long)wcet[s][z] );
+			fflush( stdout );
+		}
+		printf( " %8.2f\n", (double)wcet[s][SIZES - 1] / (double)( wcet[s][0] ? wcet[s][0] : 1 ) );
+	}
+
+	printf( "\n" );
+	for ( s = 0; s < SCENARIOS; ++s ) {
+		for ( z = 0; z < SIZES; ++z ) {
+			if ( bound != 0 && wcet[s][z] > bound ) {
+				printf( "FAIL %s: %llu ticks on %zu KiB, over the bound of %llu\n", scenarios[s].name,
+						(unsigned long long)wcet[s][z], arena_sizes[z] >> 10, (unsigned long long)bound );
+				failed = 1;
+			}
+		}
+		if ( (double)wcet[s][SIZES - 1] > growth * (double)wcet[s][0] + (double)slack ) {
+			printf( "FAIL %s: %llu ticks on %zu KiB against %llu on %zu KiB, grows with the arena\n", scenarios[s].name,
+					(unsigned long long)wcet[s][SIZES - 1], arena_sizes[SIZES - 1] >> 10,
+					(unsigned long long)wcet[s][0], arena_sizes[0] >> 10 );
+			failed = 1;
+		}
+	}
+	printf( "%s\n", failed ? "FAIL" : "PASS" );
+	return failed;
+}